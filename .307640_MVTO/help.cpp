@@ -41,8 +41,12 @@
 //     return;
 // }
 
-MemoryObject::MemoryObject() {
+MemoryObject::MemoryObject(size_t size) {
     this->id_deleted = -1;
+    this->latest = nullptr;
+    this->installing = 0;
+    this->size = size;
+    this->base = nullptr;
     return;
 }
 
@@ -52,6 +56,11 @@ MemoryObject::~MemoryObject() {
 
 Region::Region(size_t size, size_t align) {
     t_count = 0;
+    this->commits = 0;
+    this->horizon = 0;
+    this->retain_commits = 0;
+    this->retain_time = chrono::nanoseconds(0);
+    this->first = nullptr;
     this->size = size;
     this->align = align;
 }
@@ -63,6 +72,7 @@ Region::~Region() {
 TransactionObject::TransactionObject(int t_id, bool is_ro) {
     this->t_id = t_id;
     this->is_ro = is_ro;
+    this->pinned = false;
 }
 
 TransactionObject::~TransactionObject() {
@@ -72,6 +82,9 @@ TransactionObject::~TransactionObject() {
 VersionTuple::VersionTuple(int ts, void* data) {
     this->data = data;
     this->ts = ts;
+    this->commit_seq = 0;
+    this->max_read = 0;
+    this->older = nullptr;
 }
 
 VersionTuple::~VersionTuple() {
@@ -83,6 +96,7 @@ Write::Write(shared_ptr<MemoryObject> object, size_t size, WriteType type) {
     this->size = size;
     this->type = type;
     this->read = false;
+    this->data = nullptr;
 }
 
 Write::~Write() {
@@ -3,6 +3,7 @@
 // External headers
 #include <atomic>
 #include <mutex>
+#include <shared_mutex>
 #include <memory>
 #include <list>
 #include <stdlib.h>
@@ -11,7 +12,9 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <utility>
+#include <chrono>
 
 // Requested features
 #ifndef _GNU_SOURCE
@@ -103,22 +106,28 @@ class VersionTuple {
 public:
     int ts;
     void* data;
-    vector<int> readList;
+    atomic<int> max_read; // Largest timestamp that read this version
+    atomic<VersionTuple*> older; // Next older version in the chain
+    int commit_seq;                          // Region commit count when installed
+    chrono::steady_clock::time_point commit_time;
     VersionTuple(int ts, void* data);
     ~VersionTuple();
-    // VersionTuple copyable/movable for now
-    // VersionTuple(const VersionTuple&) = delete;
-    // VersionTuple& operator=(const VersionTuple&) = delete; 
-    // VersionTuple(VersionTuple&&) = delete;
-    // VersionTuple& operator=(VersionTuple&&) = delete;
+    VersionTuple(const VersionTuple&) = delete;
+    VersionTuple& operator=(const VersionTuple&) = delete; 
+    VersionTuple(VersionTuple&&) = delete;
+    VersionTuple& operator=(VersionTuple&&) = delete;
 };
 
 class MemoryObject {
 public:
-    recursive_mutex lock;
-    vector<VersionTuple*> versions;
-    int id_deleted;
-    MemoryObject();
+    shared_mutex lock; // Shared for lookups, exclusive to validate and install
+    vector<VersionTuple*> versions; // Sorted by increasing timestamp, for deep lookups and maintenance
+    atomic<VersionTuple*> latest;   // Head of the newest-first chain, walked without the lock
+    atomic<int> installing;         // Timestamp of the version being validated and installed, 0 if none
+    atomic<int> id_deleted;
+    void* base;  // Address range handed to the user, never dereferenced
+    size_t size;
+    MemoryObject(size_t size);
     ~MemoryObject();  
     MemoryObject(const MemoryObject&) = delete;
     MemoryObject& operator=(const MemoryObject&) = delete; 
@@ -135,7 +144,7 @@ enum class WriteType: int {
 class Write {
 public:
     shared_ptr<MemoryObject> object;
-    void* data;
+    void* data; // Private copy of the whole object
     size_t size;
     WriteType type;
     bool read;
@@ -151,8 +160,8 @@ class TransactionObject {
 public:
     int t_id;
     bool is_ro;
+    bool pinned; // Read-only at a past timestamp, leaves no read marks
     vector<shared_ptr<Write>> writes;
-    vector<shared_ptr<MemoryObject>> reads;
     TransactionObject(int t_id, bool is_ro);
     ~TransactionObject(); 
     TransactionObject(const TransactionObject&) = delete;
@@ -164,11 +173,15 @@ public:
 class Region {
 public:
     int t_count;
+    int commits;
+    int horizon; // Smallest timestamp whose snapshot is still fully retained
+    int retain_commits;            // Versions kept for this many commits (TM_RETAIN_COMMITS)
+    chrono::nanoseconds retain_time; // Versions kept for this long (TM_RETAIN_MS)
     recursive_mutex lock_trans;
     recursive_mutex lock_mem;
-    vector<shared_ptr<MemoryObject>> memory;
-    map<void*,pair<int,int>> memory_map;
-    vector<shared_ptr<TransactionObject>> trans;
+    map<void*, shared_ptr<MemoryObject>> memory_map; // Base address -> object
+    unordered_map<TransactionObject*, shared_ptr<TransactionObject>> trans;
+    void* first;
     size_t size;
     size_t align;
     Region(size_t size, size_t align);
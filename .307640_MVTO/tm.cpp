@@ -16,6 +16,228 @@
 #include <help.hpp>
 #include <tm.hpp>
 
+// -------------------------------------------------------------------------- //
+// Helper functions
+
+/** Find the committed object whose address range contains the given address.
+ * @param offset Receives the offset of the address in the object
+ * @return Object, 'nullptr' if none
+**/
+shared_ptr<MemoryObject> findObject(Region* reg, void const* addr, size_t* offset) {
+    lock_guard<recursive_mutex> lock_m(reg->lock_mem);
+    auto it = reg->memory_map.upper_bound(const_cast<void*>(addr));
+    if (unlikely(it == reg->memory_map.begin()))
+        return nullptr;
+    --it;
+    size_t off = (char*) addr - (char*) it->first;
+    if (unlikely(off >= it->second->size))
+        return nullptr;
+    *offset = off;
+    return it->second;
+}
+
+/** Find the pending write (or allocation) of the transaction whose object contains the given address.
+ * @param offset Receives the offset of the address in the object
+ * @return Write, 'nullptr' if none
+**/
+shared_ptr<Write> findWrite(TransactionObject* tran, void const* addr, size_t* offset) {
+    for (auto& write: tran->writes) {
+        size_t off = (char*) addr - (char*) write->object->base;
+        if (off < write->object->size) {
+            *offset = off;
+            return write;
+        }
+    }
+    return nullptr;
+}
+
+/** Number of chain links a lookup follows before falling back to the binary search.
+**/
+static const size_t max_walk = 8;
+
+/** Newest version older than the given timestamp, with the object lock held.
+ * @return Version, 'nullptr' if none
+**/
+VersionTuple* findVersion(shared_ptr<MemoryObject> obj, int t_id) {
+    auto it = lower_bound(obj->versions.begin(), obj->versions.end(), t_id, [](VersionTuple* ver, int ts) {
+        return ver->ts < ts;
+    });
+    if (it == obj->versions.begin())
+        return nullptr;
+    return *(it - 1);
+}
+
+/** Newest version older than the given timestamp, walking the chain without any lock.
+ * @param deep Set if the chain is longer than 'max_walk' above the version
+ * @return Version, 'nullptr' if none (or deep)
+**/
+VersionTuple* walkVersion(shared_ptr<MemoryObject> obj, int t_id, bool* deep) {
+    VersionTuple* ver = obj->latest.load(memory_order_acquire);
+    for (size_t walked = 0; ver != nullptr && ver->ts >= t_id; ++walked) {
+        if (unlikely(walked == max_walk)) {
+            *deep = true;
+            return nullptr;
+        }
+        ver = ver->older.load(memory_order_acquire);
+    }
+    return ver;
+}
+
+/** Insert a committed version in both the chain and the sorted array, with the object lock held exclusively.
+**/
+void installVersion(shared_ptr<MemoryObject> obj, VersionTuple* ver) {
+    auto pos = lower_bound(obj->versions.begin(), obj->versions.end(), ver->ts, [](VersionTuple* other, int ts) {
+        return other->ts < ts;
+    });
+    ver->older.store(pos == obj->versions.begin() ? nullptr : *(pos - 1), memory_order_relaxed);
+    if (pos == obj->versions.end())
+        obj->latest.store(ver, memory_order_release);
+    else
+        (*pos)->older.store(ver, memory_order_release);
+    obj->versions.insert(pos, ver);
+}
+
+/** Record that the given transaction read a version.
+**/
+void markRead(VersionTuple* ver, int t_id) {
+    int seen = ver->max_read.load();
+    while (seen < t_id && !ver->max_read.compare_exchange_weak(seen, t_id))
+        continue;
+}
+
+/** Whether the object was freed before the given timestamp.
+**/
+bool deletedBefore(shared_ptr<MemoryObject> obj, int t_id) {
+    int id_deleted = obj->id_deleted.load();
+    return id_deleted != -1 && id_deleted < t_id;
+}
+
+/** Find (and unless pinned, mark as read) the version a transaction reads, without the object lock in the common case.
+ * A committer announces its timestamp in 'installing' before validating, and a reader marks before re-checking;
+ * so either the committer sees the mark and aborts, or the reader sees the new version and retries.
+ * @return Version, 'nullptr' if the transaction must abort
+**/
+VersionTuple* readVersion(shared_ptr<MemoryObject> obj, TransactionObject* tran) {
+    int t_id = tran->t_id;
+    while (true) {
+        bool deep = false;
+        VersionTuple* ver = walkVersion(obj, t_id, &deep);
+        if (unlikely(deep)) {
+            shared_lock<shared_mutex> lock_obj(obj->lock);
+            ver = findVersion(obj, t_id);
+            if (ver != nullptr && !tran->pinned)
+                markRead(ver, t_id);
+            return ver == nullptr || deletedBefore(obj, t_id) ? nullptr : ver;
+        }
+        if (unlikely(ver == nullptr))
+            return nullptr;
+        if (!tran->pinned) {
+            markRead(ver, t_id);
+            int installing = obj->installing.load();
+            if (unlikely(installing != 0 && ver->ts < installing && installing < t_id)) {
+                pause();
+                continue;
+            }
+            if (unlikely(walkVersion(obj, t_id, &deep) != ver))
+                continue;
+        }
+        return deletedBefore(obj, t_id) ? nullptr : ver;
+    }
+}
+
+/** Withdraw the announcements of a committing transaction, with the object locks held.
+**/
+void clearInstalling(TransactionObject* tran) {
+    for (shared_ptr<Write> write: tran->writes)
+        write->object->installing.store(0);
+}
+
+/** Smallest timestamp a transaction still running may read at, with 'lock_trans' held.
+ * @param writers_only Whether to only consider the transactions that may install versions
+**/
+int oldestActive(Region* reg, bool writers_only) {
+    int oldest = reg->t_count + 1;
+    for (auto& pair_tran: reg->trans) {
+        TransactionObject* tran = pair_tran.first;
+        if (writers_only && tran->is_ro)
+            continue;
+        oldest = min(oldest, tran->t_id);
+    }
+    return oldest;
+}
+
+/** Whether a version was still the latest one inside the retention window.
+ * @param next Version that superseded it
+**/
+bool retained(Region* reg, VersionTuple* next, int seq, chrono::steady_clock::time_point now) {
+    return seq - next->commit_seq < reg->retain_commits || now - next->commit_time < reg->retain_time;
+}
+
+/** Number of leading versions that neither a running transaction nor the retention window needs, with the object lock held.
+ * @param horizon Oldest timestamp still running
+**/
+size_t prunable(Region* reg, shared_ptr<MemoryObject> obj, int horizon, int seq, chrono::steady_clock::time_point now) {
+    // Versions are sorted: everything older than the newest version below 'horizon' is unreachable
+    size_t keeper = 0;
+    while (keeper + 1 < obj->versions.size() && obj->versions[keeper + 1]->ts < horizon)
+        ++keeper;
+    size_t dropped = 0;
+    while (dropped < keeper && !retained(reg, obj->versions[dropped + 1], seq, now))
+        ++dropped;
+    return dropped;
+}
+
+/** Drop the versions that neither a running transaction nor the retention window needs, with the object lock held.
+ * @param horizon Oldest timestamp still running when the commit started
+**/
+void prune(Region* reg, shared_ptr<MemoryObject> obj, int horizon, int seq, chrono::steady_clock::time_point now) {
+    if (likely(prunable(reg, obj, horizon, seq, now) == 0))
+        return;
+    vector<VersionTuple*> garbage;
+    {
+        // A snapshot may have been pinned since 'horizon' was computed: decide and publish the new horizon atomically
+        lock_guard<recursive_mutex> lock_trans(reg->lock_trans);
+        size_t dropped = prunable(reg, obj, min(horizon, oldestActive(reg, false)), seq, now);
+        if (dropped == 0)
+            return;
+        garbage.assign(obj->versions.begin(), obj->versions.begin() + dropped);
+        int oldest_ts = obj->versions[dropped]->ts; // Snapshots at or before it would need a dropped version
+        obj->versions.erase(obj->versions.begin(), obj->versions.begin() + dropped);
+        obj->versions.front()->older.store(nullptr, memory_order_release); // No running lookup goes past it
+        reg->horizon = max(reg->horizon, oldest_ts + 1);
+    }
+    for (VersionTuple* ver: garbage) {
+        free(ver->data);
+        delete ver;
+    }
+}
+
+void removeT(Region* reg, TransactionObject* tran) {
+    for (shared_ptr<Write> write: tran->writes) {
+        if (write->data != NULL)
+            free(write->data);
+        if (write->type == WriteType::alloc)
+            free(write->object->base);
+    }
+    lock_guard<recursive_mutex> lock_trans(reg->lock_trans);
+    reg->trans.erase(tran);
+}
+
+/** Whether a version written at the given timestamp would not invalidate any read, with the object lock held.
+ * Only the version it would follow matters: later readers of older versions are impossible.
+**/
+bool check_version(int t_id, shared_ptr<MemoryObject> obj) noexcept {
+    VersionTuple* pred = findVersion(obj, t_id);
+    return pred == nullptr || pred->max_read.load() <= t_id;
+}
+
+/** Whether the object can be freed at the given timestamp, with the object lock held.
+**/
+bool check_free(int t_id, shared_ptr<MemoryObject> obj) noexcept {
+    VersionTuple* newest = obj->versions.back();
+    return newest->ts <= t_id && newest->max_read.load() <= t_id;
+}
+
 // -------------------------------------------------------------------------- //
 
 /** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
@@ -28,56 +250,50 @@ shared_t tm_create(size_t size, size_t align) noexcept {
     if (unlikely(!reg)) {
         return invalid_shared;
     }
-    shared_ptr<MemoryObject> first = make_shared<MemoryObject>();
+    const char* retain = getenv("TM_RETAIN_COMMITS");
+    if (retain != nullptr)
+        reg->retain_commits = atoi(retain);
+    retain = getenv("TM_RETAIN_MS");
+    if (retain != nullptr)
+        reg->retain_time = chrono::milliseconds(atol(retain));
+    shared_ptr<MemoryObject> first = make_shared<MemoryObject>(size);
     if (unlikely(!first)) {
-        free(reg);
+        delete reg;
         return invalid_shared;
     }
     VersionTuple* first_tuple = new VersionTuple(0, NULL);
     if (unlikely(!first_tuple)) {
-        free(reg);
+        delete reg;
         return invalid_shared;
     }
-    if (unlikely(posix_memalign(&(first_tuple->data), align, size) != 0)) {
-        free(reg);
-        free(first_tuple);
+    if (unlikely(posix_memalign(&(first_tuple->data), align, size) != 0 || posix_memalign(&(first->base), align, size) != 0)) {
+        delete reg;
+        delete first_tuple;
         return invalid_shared;
     }
     memset(first_tuple->data, 0, size);
-    first->versions.push_back(first_tuple);
-    reg->memory.push_back(first);
-    void* address_first = (void*) first.get();
-    for (size_t i = 0; i < size; i+=align) {
-        reg->memory_map[address_first+i] = make_pair(0,i);
-    }
+    first_tuple->commit_time = chrono::steady_clock::now();
+    installVersion(first, first_tuple);
+    reg->memory_map[first->base] = first;
+    reg->first = first->base;
     return reg;
 }
 
-void removeT(Region* reg, tx_t tx) {
-    lock_guard<recursive_mutex> lock_trans(reg->lock_trans);
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx-1);
-    for(shared_ptr<Write> write: tran->writes) {
-        if(write->data!=NULL)
-            free(write->data);
-    }
-    reg->trans.erase(reg->trans.begin()+tx-1);
-}
-
 /** Destroy (i.e. clean-up + free) a given shared memory region.
  * @param shared Shared memory region to destroy, with no running transaction
 **/
 void tm_destroy(shared_t shared) noexcept {
     Region* reg = (Region*) shared;
-    for(shared_ptr<MemoryObject> mem: reg->memory) {
-        for(VersionTuple* ver: mem->versions) {
+    for (auto& pair_obj: reg->memory_map) {
+        for(VersionTuple* ver: pair_obj.second->versions) {
             free(ver->data);
-            free(ver);
+            delete ver;
         }
+        free(pair_obj.second->base);
     }
-    for(shared_ptr<TransactionObject>tran: reg->trans) {
-        removeT(reg, tran->t_id);
-    }
-    free(reg);
+    while (!reg->trans.empty())
+        removeT(reg, reg->trans.begin()->first);
+    delete reg;
 }
 
 /** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
@@ -85,9 +301,7 @@ void tm_destroy(shared_t shared) noexcept {
  * @return Start address of the first allocated segment
 **/
 void* tm_start(shared_t shared) noexcept {
-    return ((Region*)shared)->memory.front().get();
-    //return ((Region*)shared)->memory.front()->versions[0]->data;
-    //TODO: understand what I should return to the user. Do I need to return directly the region where to write? If yes need to rethink
+    return ((Region*)shared)->first;
 }
 
 /** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
@@ -120,30 +334,39 @@ tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
     if (unlikely(!tran)) {
         return invalid_tx;
     }
-    reg->trans.push_back(tran);
-    return tran->t_id;
+    reg->trans[tran.get()] = tran;
+    return (tx_t) tran.get();
 }
 
-bool check_version(int t_id, shared_ptr<MemoryObject> obj) noexcept {
-    for(VersionTuple* version: obj->versions) {
-        for(int read_id: version->readList) {
-            if(version->ts < t_id && t_id < read_id)
-                return false;
-        }
-    }
-    return true;
+/** [thread-safe] Return the newest timestamp whose snapshot is stable, i.e. no running transaction can still install a version below it.
+ * @param shared Shared memory region to query
+ * @return Timestamp usable with 'tm_begin_at'
+**/
+uint64_t tm_timestamp(shared_t shared) noexcept {
+    Region* reg = (Region*) shared;
+    const lock_guard<recursive_mutex> lock(reg->lock_trans);
+    return oldestActive(reg, true);
 }
 
-bool check_free(int t_id, shared_ptr<MemoryObject> obj) noexcept {
-    for(VersionTuple* version: obj->versions) {
-        if (version->ts > t_id)
-            return false;
-        for(int read_id: version->readList) {
-            if(t_id < read_id)
-                return false;
-        }
+/** [thread-safe] Begin a read-only transaction that reads the snapshot at a past timestamp.
+ * It never aborts and leaves no read marks, so it never aborts writers either.
+ * @param shared    Shared memory region to start a transaction on
+ * @param timestamp Timestamp to read at, between the retention horizon and 'tm_timestamp'
+ * @return Opaque transaction ID, 'invalid_tx' if that snapshot is no longer (or not yet) available
+**/
+tx_t tm_begin_at(shared_t shared, uint64_t timestamp) noexcept {
+    Region* reg = (Region*) shared;
+    const lock_guard<recursive_mutex> lock(reg->lock_trans);
+    if (unlikely(timestamp < (uint64_t) reg->horizon || timestamp > (uint64_t) oldestActive(reg, true))) {
+        return invalid_tx;
     }
-    return true;
+    shared_ptr<TransactionObject> tran = make_shared<TransactionObject>((int) timestamp, true);
+    if (unlikely(!tran)) {
+        return invalid_tx;
+    }
+    tran->pinned = true;
+    reg->trans[tran.get()] = tran;
+    return (tx_t) tran.get();
 }
 
 /** [thread-safe] End the given transaction.
@@ -153,73 +376,77 @@ bool check_free(int t_id, shared_ptr<MemoryObject> obj) noexcept {
 **/
 bool tm_end(shared_t shared, tx_t tx) noexcept {
     Region* reg = (Region*) shared;
-    unique_lock<recursive_mutex> lock_trans(reg->lock_trans);
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx-1);
-    lock_trans.unlock();
-    vector<shared_ptr<lock_guard<recursive_mutex>>> my_locks;
-    for (shared_ptr<MemoryObject> mem: tran->reads) {
-        my_locks.push_back(make_shared<lock_guard<recursive_mutex>>(mem->lock));
-        if(mem->id_deleted!=-1 && mem->id_deleted < tran->t_id) {
-            removeT(reg, tx);
-            return false;
-        }
+    TransactionObject* tran = (TransactionObject*) tx;
+    if (tran->pinned) {
+        removeT(reg, tran);
+        return true;
     }
     if(tran->is_ro == true) {
-        removeT(reg, tx);
+        removeT(reg, tran);
         return true;
     }
+    // Lock every written object, in address order to avoid deadlocks
+    vector<MemoryObject*> objects;
+    for (shared_ptr<Write> write: tran->writes)
+        objects.push_back(write->object.get());
+    sort(objects.begin(), objects.end());
+    objects.erase(unique(objects.begin(), objects.end()), objects.end());
+    vector<shared_ptr<lock_guard<shared_mutex>>> my_locks;
+    for (MemoryObject* mem: objects)
+        my_locks.push_back(make_shared<lock_guard<shared_mutex>>(mem->lock));
+    for (shared_ptr<Write> write: tran->writes) {
+        if (write->type != WriteType::alloc)
+            write->object->installing.store(tran->t_id);
+    }
     for(shared_ptr<Write> write: tran->writes) {
-        my_locks.push_back(make_shared<lock_guard<recursive_mutex>>(write->object->lock));
+        if (write->type == WriteType::alloc)
+            continue;
         if(!check_version(tran->t_id, write->object)) {
-            removeT(reg, tx);
+            clearInstalling(tran);
+            my_locks.clear();
+            removeT(reg, tran);
             return false;
         }
         if (write->type == WriteType::del) {
             if(!check_free(tran->t_id, write->object)) {
-            removeT(reg, tx);
-            return false;
+                clearInstalling(tran);
+                my_locks.clear();
+                removeT(reg, tran);
+                return false;
             }
         }
     }
 
+    int seq;
+    int horizon;
+    {
+        lock_guard<recursive_mutex> lock_trans(reg->lock_trans);
+        seq = ++reg->commits;
+        horizon = oldestActive(reg, false);
+    }
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
     for (shared_ptr<Write> write: tran->writes) {
         if(write->type == WriteType::del) 
             write->object->id_deleted = tran->t_id;
-        else if (write->type == WriteType::write) {
-            int i = 0;
-            VersionTuple* new_version = new VersionTuple(tran->t_id, NULL);
-            if (unlikely(posix_memalign(&(new_version->data), reg->align, write->size) != 0)) {
-                free(new_version);
-                removeT(reg, tx); //TODO: what happens if I abort here??
-                return false;
-            }
-            memcpy(new_version->data, write->data, write->size);
-            bool inserted = false;
-            for(VersionTuple* version: write->object->versions) {
-                if(version->ts > tran->t_id) {
-                    write->object->versions.insert(write->object->versions.begin() + i, new_version);
-                    inserted = true;
-                    break;
-                }
-                i+=1;
-            }
-            if(!inserted)
-                write->object->versions.push_back(new_version);
-        }
-        else if (write->type == WriteType::alloc) {
-            VersionTuple* new_version = new VersionTuple(tran->t_id, NULL);
-            if (unlikely(posix_memalign(&(new_version->data), reg->align, write->size) != 0)) {
-                free(new_version);
-                removeT(reg, tx); //TODO: what happens if I abort here??
+        else {
+            // The private copy becomes the new version
+            VersionTuple* new_version = new VersionTuple(tran->t_id, write->data);
+            new_version->commit_seq = seq;
+            new_version->commit_time = now;
+            write->data = NULL;
+            installVersion(write->object, new_version);
+            if (write->type == WriteType::alloc) {
+                write->type = WriteType::write; // Now owned by the region
+                lock_guard<recursive_mutex> lock_m(reg->lock_mem);
+                reg->memory_map[write->object->base] = write->object;
+            } else {
+                prune(reg, write->object, horizon, seq, now);
             }
-            memcpy(new_version->data, write->data, write->size);
-            write->object->versions.push_back(new_version);
-            unique_lock<recursive_mutex> lock_m(reg->lock_mem);
-            reg->memory.push_back(write->object);
-            lock_m.unlock();
         }
     }
-    removeT(reg, tx);
+    clearInstalling(tran);
+    my_locks.clear();
+    removeT(reg, tran);
     return true;
 }
 
@@ -233,37 +460,25 @@ bool tm_end(shared_t shared, tx_t tx) noexcept {
 **/
 bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
     Region* reg = (Region*) shared;
-    shared_ptr<MemoryObject> obj = reg->memory.at(reg->memory_map[(void*) source]);
-    // May be not needed to lock here
-    unique_lock<recursive_mutex> lock(reg->lock_trans);
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx-1);
-    lock.unlock();
-    unique_lock<recursive_mutex> lock_obj(obj->lock);
-    // TODO: may check directly here the id of whom as freed the segment and abort
-    for(auto& write: tran->writes) {
-        if(write->object == obj) {
-            memcpy(target, write->data, size);
-            write->read = true;
-            return true;
-        }
+    TransactionObject* tran = (TransactionObject*) tx;
+    size_t offset;
+    shared_ptr<Write> write = findWrite(tran, source, &offset);
+    if (write != nullptr) {
+        memcpy(target, (char*) write->data + offset, size);
+        return true;
     }
-    int t_id = tran->t_id;
-    VersionTuple* best_vers = nullptr;
-    int best_ts = 0;
-    for(VersionTuple* ver: obj->versions) {
-        if((ver->ts < t_id) && (best_ts < ver->ts)) {
-            best_vers = ver;
-            best_ts = ver->ts;
-        }
+    shared_ptr<MemoryObject> obj = findObject(reg, source, &offset);
+    if (unlikely(obj == nullptr)) {
+        removeT(reg, tran);
+        return false;
     }
+    VersionTuple* best_vers = readVersion(obj, tran);
     if (best_vers==nullptr) {
-        removeT(reg, tx);
+        removeT(reg, tran);
         return false;
     }
-    best_vers->readList.push_back(t_id);
-    lock_obj.unlock();
-    memcpy(target, best_vers->data, size);
-    tran->reads.push_back(shared_ptr<MemoryObject>(obj));
+    // Versions at or above the oldest running timestamp are never pruned
+    memcpy(target, (char*) best_vers->data + offset, size);
     return true;
 }
 
@@ -277,31 +492,31 @@ bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* ta
 **/
 bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
     Region* reg = (Region*) shared;
-    shared_ptr<MemoryObject> obj = reg->memory.at(reg->memory_map[target]);
-    // May be not needed to lock here
-    unique_lock<recursive_mutex> lock(reg->lock_trans);
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx-1);
-    lock.unlock();
-    bool found = false;
-    for(auto& write: tran->writes) {
-        if(write->object == obj) {
-            memcpy(write->data, source, size);
-            found = true;
+    TransactionObject* tran = (TransactionObject*) tx;
+    size_t offset;
+    shared_ptr<Write> write = findWrite(tran, target, &offset);
+    if (write == nullptr) {
+        shared_ptr<MemoryObject> obj = findObject(reg, target, &offset);
+        if (unlikely(obj == nullptr)) {
+            removeT(reg, tran);
+            return false;
         }
-    }
-    if (!found) {
-        shared_ptr<Write> new_write = make_shared<Write>(shared_ptr<MemoryObject>(obj), size, WriteType::write);
-        if(unlikely(!new_write)) {
-            removeT(reg, tx);
+        // The new version starts as a copy of the one we would read, which counts as a read
+        VersionTuple* best_vers = readVersion(obj, tran);
+        if (unlikely(best_vers == nullptr)) {
+            removeT(reg, tran);
             return false;
         }
-        if (unlikely(posix_memalign(&(new_write->data), reg->align, size) != 0)) {
-            removeT(reg, tx);
+        write = make_shared<Write>(obj, obj->size, WriteType::write);
+        if (unlikely(posix_memalign(&(write->data), reg->align, obj->size) != 0)) {
+            removeT(reg, tran);
             return false;
         }
-        memcpy(new_write->data, source, size);
-        tran->writes.push_back(new_write);
+        memcpy(write->data, best_vers->data, obj->size);
+        write->read = true;
+        tran->writes.push_back(write);
     }
+    memcpy((char*) write->data + offset, source, size);
     return true;
 }
 
@@ -314,28 +529,22 @@ bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* t
 **/
 Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
     Region* reg = (Region*) shared;
-    // May be not needed to lock here
-    unique_lock<recursive_mutex> lock(reg->lock_trans);
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx-1);
-    lock.unlock();
-    shared_ptr<MemoryObject> mem = make_shared<MemoryObject>();
+    TransactionObject* tran = (TransactionObject*) tx;
+    shared_ptr<MemoryObject> mem = make_shared<MemoryObject>(size);
     if (unlikely(!mem)) {
         return Alloc::nomem;
     }
-    lock_guard<recursive_mutex> lock_obj(mem->lock);
-    VersionTuple* first_tuple = new VersionTuple(tran->t_id, NULL);
-    if (unlikely(!first_tuple)) {
+    shared_ptr<Write> new_write = make_shared<Write>(mem, size, WriteType::alloc);
+    if (unlikely(posix_memalign(&(mem->base), reg->align, size) != 0)) {
         return Alloc::nomem;
     }
-    if (unlikely(posix_memalign(&(first_tuple->data), reg->align, size) != 0)) {
-        free(first_tuple);
+    if (unlikely(posix_memalign(&(new_write->data), reg->align, size) != 0)) {
+        free(mem->base);
         return Alloc::nomem;
     }
-    memset(first_tuple->data, 0, size);
-    mem->versions.push_back(first_tuple);
-    *target = mem.get();
-    shared_ptr<Write> new_write = make_shared<Write>(mem, 0, WriteType::alloc);
+    memset(new_write->data, 0, size);
     tran->writes.push_back(new_write);
+    *target = mem->base;
     return Alloc::success;
 }
 
@@ -347,11 +556,26 @@ Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
 **/
 bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
     Region* reg = (Region*) shared;
-    MemoryObject* obj = (MemoryObject*) target;
-    unique_lock<recursive_mutex> lock(reg->lock_trans);
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx-1);
-    lock.unlock();
-    shared_ptr<Write> new_write = make_shared<Write>(shared_ptr<MemoryObject>(obj), 0, WriteType::del);
+    TransactionObject* tran = (TransactionObject*) tx;
+    size_t offset;
+    shared_ptr<Write> write = findWrite(tran, target, &offset);
+    if (write != nullptr && write->type == WriteType::alloc) {
+        // Allocated by this very transaction: nobody else has seen it
+        free(write->data);
+        free(write->object->base);
+        tran->writes.erase(find(tran->writes.begin(), tran->writes.end(), write));
+        return true;
+    }
+    if (write != nullptr) {
+        write->type = WriteType::del;
+        return true;
+    }
+    shared_ptr<MemoryObject> obj = findObject(reg, target, &offset);
+    if (unlikely(obj == nullptr || offset != 0)) {
+        removeT(reg, tran);
+        return false;
+    }
+    shared_ptr<Write> new_write = make_shared<Write>(obj, 0, WriteType::del);
     tran->writes.push_back(new_write);
     return true;
 }
@@ -0,0 +1,92 @@
+// External headers
+#include <cstdio>
+
+// Internal headers
+#include "conflict.hpp"
+
+// -------------------------------------------------------------------------- //
+
+static char const* const kind_names[conflict_kinds] = { "read-newer", "read-changed", "read-locked", "write-owned", "commit-locked", "commit-stale" };
+
+HotSpot::HotSpot() {
+    this->count = 0;
+    memset(this->kinds, 0, sizeof(this->kinds));
+}
+
+ConflictProfiler::ConflictProfiler(size_t top, uint64_t period) {
+    this->top = top;
+    this->period = period;
+    this->conflicts.store(0);
+    this->sampled = 0;
+}
+
+/** Count a conflict of the calling thread, and tell whether to record it.
+ * @return Whether the conflict is sampled
+**/
+bool ConflictProfiler::sample() {
+    static thread_local uint64_t countdown = 0;
+    this->conflicts.fetch_add(1, memory_order_relaxed);
+    if (likely(countdown > 0)) {
+        --countdown;
+        return false;
+    }
+    countdown = this->period - 1;
+    return true;
+}
+
+/** Record a sampled conflict.
+ * @param kind    Kind of conflict
+ * @param segment ID of the segment holding the word
+ * @param offset  Offset of the word in the segment
+**/
+void ConflictProfiler::record(ConflictKind kind, uint64_t segment, uint64_t offset) {
+    lock_guard<mutex> lock(this->lock_spots);
+    HotSpot& spot = this->spots[make_pair(segment, offset)];
+    ++spot.count;
+    ++spot.kinds[(int) kind];
+    ++this->sampled;
+}
+
+/** Print the hottest words and segments to the standard error.
+ * @param align Alignment of the region, to turn offsets into word indices
+**/
+void ConflictProfiler::report(size_t align) {
+    lock_guard<mutex> lock(this->lock_spots);
+    vector<pair<pair<uint64_t, uint64_t>, HotSpot*>> ranked;
+    map<uint64_t, uint64_t> segments;
+    for (auto& spot: this->spots) {
+        ranked.emplace_back(spot.first, &spot.second);
+        segments[spot.first.first] += spot.second.count;
+    }
+    sort(ranked.begin(), ranked.end(), [](auto const& a, auto const& b) { return a.second->count > b.second->count; });
+    double total = this->sampled > 0 ? (double) this->sampled : 1.;
+    fprintf(stderr, "conflicts: %lu conflicts, %lu sampled (1 in %lu), top %zu of %zu hot spots:\n", (unsigned long) this->conflicts.load(), (unsigned long) this->sampled, (unsigned long) this->period, min(this->top, ranked.size()), ranked.size());
+    for (size_t i = 0; i < ranked.size() && i < this->top; ++i) {
+        auto const& key = ranked[i].first;
+        HotSpot const& spot = *ranked[i].second;
+        fprintf(stderr, "conflicts: %3zu. seg %lu%s+%#lx (word %lu): %lu (%.1f%%)", i + 1, (unsigned long) key.first, key.first == 0 ? " (first)" : "", (unsigned long) key.second, (unsigned long) (key.second / align), (unsigned long) spot.count, 100. * spot.count / total);
+        for (size_t k = 0; k < conflict_kinds; ++k) {
+            if (spot.kinds[k] > 0)
+                fprintf(stderr, " %s %lu", kind_names[k], (unsigned long) spot.kinds[k]);
+        }
+        fprintf(stderr, "\n");
+    }
+    vector<pair<uint64_t, uint64_t>> by_segment(segments.begin(), segments.end());
+    sort(by_segment.begin(), by_segment.end(), [](auto const& a, auto const& b) { return a.second > b.second; });
+    fprintf(stderr, "conflicts: by segment:");
+    for (size_t i = 0; i < by_segment.size() && i < this->top; ++i)
+        fprintf(stderr, " seg %lu %lu (%.1f%%)", (unsigned long) by_segment[i].first, (unsigned long) by_segment[i].second, 100. * by_segment[i].second / total);
+    fprintf(stderr, "\n");
+}
+
+ConflictProfiler* conflicts_from_env() {
+    const char* top = getenv("TM_CONFLICTS");
+    if (top == nullptr)
+        return nullptr;
+    size_t nbtop = strtoul(top, nullptr, 10);
+    if (nbtop == 0)
+        return nullptr;
+    const char* period = getenv("TM_CONFLICTS_PERIOD");
+    uint64_t every = period != nullptr ? strtoull(period, nullptr, 10) : 1;
+    return new ConflictProfiler(nbtop, every > 0 ? every : 1);
+}
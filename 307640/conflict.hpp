@@ -0,0 +1,52 @@
+#pragma once
+
+// External headers
+#include <map>
+
+// Internal headers
+#include "help.hpp"
+
+// -------------------------------------------------------------------------- //
+// Optional conflict profiler: samples the words whose conflicts abort transactions, aggregated by
+// segment and offset, and reports the hot spots at 'tm_destroy'.
+// Enabled by setting TM_CONFLICTS to the number of hot spots to report; knob:
+//   TM_CONFLICTS_PERIOD  Record one conflict out of that many, per thread (default 1)
+
+enum class ConflictKind: int {
+    read_newer = 0,    // 'tm_read' found a version newer than the snapshot
+    read_changed = 1,  // 'tm_read' saw the version change while copying the word
+    read_locked = 2,   // 'tm_read' found the word locked by a committer
+    write_owned = 3,   // 'tm_write' lost the ownership of the word (eager mode)
+    commit_locked = 4, // 'tm_end' timed out locking a written word
+    commit_stale = 5   // 'tm_end' found a read word overwritten since it was read
+};
+
+constexpr static size_t conflict_kinds = 6;
+
+/** Conflicts sampled on one word, by kind.
+**/
+class HotSpot {
+public:
+    uint64_t count;
+    uint64_t kinds[conflict_kinds];
+    HotSpot();
+};
+
+class ConflictProfiler {
+public:
+    size_t top;
+    uint64_t period;
+    atomic<uint64_t> conflicts; // Every conflict, sampled or not
+    mutex lock_spots;
+    map<pair<uint64_t, uint64_t>, HotSpot> spots; // By segment ID and offset
+    uint64_t sampled;
+    ConflictProfiler(size_t top, uint64_t period);
+    bool sample();
+    void record(ConflictKind kind, uint64_t segment, uint64_t offset);
+    void report(size_t align);
+};
+
+/** Read the conflict profiler configuration from the environment.
+ * @return Conflict profiler instance, 'nullptr' if disabled
+**/
+ConflictProfiler* conflicts_from_env();
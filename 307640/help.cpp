@@ -1,8 +1,13 @@
 #include "help.hpp"
+#include "conflict.hpp"
+#include "trace.hpp"
+#include "validate.hpp"
 
 
 MemorySegment::MemorySegment(size_t size) {
+    this->id = 0;
     this->size = size;
+    this->mapped = false;
     this->is_freed.store(false);
     return;
 }
@@ -11,20 +16,57 @@ MemorySegment::~MemorySegment() {
     return;
 }
 
+/** Generation of the last created region.
+**/
+static atomic<uint64_t> region_generations{0};
+
 Region::Region(size_t size, size_t align) {
+    this->generation = ++region_generations;
     this->size = size;
     this->align = align;
     this->clock.store(0);
+    this->clock_mode = ClockMode::global;
+    this->tlc_next.store(0);
+    this->read_mode = ReadMode::invisible;
+    for (auto& stripe: this->readers)
+        stripe.store(0);
     this->tran_counter.store(0);
+    this->commit_gated.store(false);
+    this->seg_counter.store(1);
+    this->persist = nullptr;
+    this->validate_pool = nullptr;
+    this->tracer = nullptr;
+    this->conflicts = nullptr;
+    this->eager = false;
+    this->cm_threshold = 0;
+    this->greedy_clock.store(0);
+    this->report_stats = false;
 }
 
 Region::~Region() {
+    delete this->validate_pool;
+    delete this->tracer;
+    delete this->conflicts;
     return;
 }
 
-WordLock::WordLock() {
+CommitSlot::CommitSlot() {
+    this->active.store(0);
+}
+
+ReaderSlot::ReaderSlot() {
+    this->doomed.store(false);
+}
+
+PartitionClock::PartitionClock() {
+    this->clock.store(0);
+}
+
+WordLock::WordLock(void const* word) {
+    this->word = word;
     this->version.store(0);
     this->is_freed.store(false);
+    this->owner.store(0);
     return;
 }
 
@@ -36,7 +78,16 @@ TransactionObject::TransactionObject(uint t_id, bool is_ro, uint rv) {
     this->t_id = t_id;
     this->is_ro = is_ro;
     this->rv = rv;
+    this->sampled = 0;
+    this->slot = 0;
+    this->visible = false;
+    this->write_filter[0] = 0;
+    this->write_filter[1] = 0;
+    memset(this->seen, 0, sizeof(this->seen));
     this->removed = false;
+    this->ctx = nullptr;
+    this->cm_ts = no_priority;
+    this->polls = 0;
 }
 
 TransactionObject::~TransactionObject() {
@@ -52,9 +103,61 @@ Write::Write(shared_ptr<WordLock> lock, shared_ptr<MemorySegment> segment, Write
     else
         this->allocated = true;
     this->will_be_freed = false;
+    this->owns_data = false;
     this->data = nullptr;
 }
 
 Write::~Write() {
     return;
+}
+
+WordArena::WordArena() {
+    this->current = 0;
+    this->used = 0;
+}
+
+WordArena::~WordArena() {
+    for (void* chunk: this->chunks)
+        free(chunk);
+}
+
+constexpr static size_t arena_chunk_size = 16384;
+
+void* WordArena::allocate(size_t size, size_t align) {
+    if (unlikely(size > arena_chunk_size))
+        return nullptr;
+    size_t offset = (this->used + align - 1) & ~(align - 1);
+    if (unlikely(this->chunks.empty() || offset + size > arena_chunk_size)) {
+        size_t next = this->chunks.empty() ? 0 : this->current + 1;
+        if (next == this->chunks.size()) { // Only move to the new chunk once it exists
+            void* chunk;
+            if (unlikely(posix_memalign(&chunk, max(align, sizeof(void*)), arena_chunk_size) != 0))
+                return nullptr;
+            this->chunks.push_back(chunk);
+        }
+        this->current = next;
+        offset = 0;
+    }
+    this->used = offset + size;
+    return (char*) this->chunks[this->current] + offset;
+}
+
+void WordArena::reset() {
+    this->current = 0;
+    this->used = 0;
+}
+
+TxStats::TxStats() {
+    this->commits = 0;
+    this->aborts = 0;
+}
+
+ThreadContext::ThreadContext(Region* region): tran(0, false, 0) {
+    this->region = region;
+    this->tran.ctx = this;
+    this->tran.removed = true;
+}
+
+ThreadContext::~ThreadContext() {
+    return;
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 // External headers
 #include <atomic>
 #include <mutex>
+#include <memory>
+#include <algorithm>
 #include <shared_mutex>
 #include <list>
 #include <stdlib.h>
@@ -15,6 +17,7 @@
 #include <set>
 #include <unordered_set>
 #include <functional>
+#include <thread>
 
 // Requested features
 #ifndef _GNU_SOURCE
@@ -71,7 +74,7 @@
 #endif
 /** Pause for a very short amount of time.
 **/
-static inline void pause() {
+static inline void short_pause() {
 #if (defined(__i386__) || defined(__x86_64__)) && defined(USE_MM_PAUSE)
     _mm_pause();
 #else
@@ -88,12 +91,20 @@ using std::unordered_map;
 using std::unordered_set;
 using std::shared_mutex;
 
+/** Contention manager priority of short transactions, which always yield.
+**/
+constexpr static uint64_t no_priority = UINT64_MAX;
+
+class TransactionObject;
+
 class WordLock {
 public:
     recursive_timed_mutex lock;
-    atomic_uint version;
+    atomic<uint64_t> version; // Commit version, or '(slot + 1) << 32 | counter' with thread-local clocks
     atomic_bool is_freed;
-    WordLock();
+    atomic<uint64_t> owner; // Eager mode: 0 if free, else 'priority << 1 | doomed' of the transaction that will write the word
+    void const* word;       // Word the lock guards
+    WordLock(void const* word);
     ~WordLock();
     WordLock(const WordLock&) = delete;
     WordLock& operator=(const WordLock&) = delete; 
@@ -104,8 +115,10 @@ public:
 
 class MemorySegment {
 public:
+    uint64_t id;
     void* data;
     size_t size;
+    bool mapped; // Whether 'data' comes from 'Persist::map_segment' instead of 'posix_memalign'
     shared_mutex lock_pointers;
     atomic_bool is_freed;
     unordered_map<void*, shared_ptr<WordLock>> writelocks;
@@ -129,6 +142,7 @@ public:
     bool allocated;
     list<shared_ptr<WordLock>> lock_frees;
     bool will_be_freed;
+    bool owns_data;
     Write(shared_ptr<WordLock> lock, shared_ptr<MemorySegment> segment, WriteType type);
     ~Write();
 };
@@ -141,31 +155,163 @@ struct hash_pair {
     }
 };
 
+class ThreadContext;
+
+/** Versioning clocks a region can use (TM_CLOCK).
+**/
+enum class ClockMode: int {
+    global = 0,     // One clock shared by every writer
+    partitioned = 1, // One clock per partition of segments, see 'clock_partitions'
+    tlc = 2          // One clock per thread slot, see 'tlc_slots'
+};
+// With 'tlc', an ungated commit (see 'Region::commit_gated') writes no line shared with other slots;
+// a gated one still takes 'lock_commit' shared, whose reader count every committer writes.
+
+/** Number of clock partitions; a segment belongs to partition 'id % clock_partitions'.
+**/
+constexpr static size_t clock_partitions = 16;
+
+/** Number of thread-local clocks; threads beyond that share a slot, whose clock then stays atomic.
+**/
+constexpr static size_t tlc_slots = 64;
+
+/** Reader visibility a region can use (TM_VISIBLE_READS).
+**/
+enum class ReadMode: int {
+    invisible = 0, // Readers leave no trace, doomed readers only find out at their next read or at commit
+    visible = 1,   // Readers mark the stripes they read, committing writers flag the readers of the stripes they wrote
+    adaptive = 2   // Visible for the threads whose recent abort rate is high
+};
+
+/** Number of reader stripes; a word belongs to a stripe by hash, each stripe holds one reader bit per thread slot.
+**/
+constexpr static size_t reader_stripes = 4096;
+
+/** Per-slot reader state, polled by the slot's running transaction.
+**/
+class alignas(64) ReaderSlot {
+public:
+    atomic_bool doomed; // Set by a writer that overwrote a stripe the reader marked
+    ReaderSlot();
+};
+
+/** Per-slot count of the committers in write-back without holding 'lock_commit'.
+**/
+class alignas(64) CommitSlot {
+public:
+    atomic_uint active;
+    CommitSlot();
+};
+
+class alignas(64) PartitionClock {
+public:
+    atomic_uint clock;
+    PartitionClock();
+};
+
 class TransactionObject {
 public:
     uint t_id;
     bool is_ro;
     uint rv;
     uint wv;
+    uint32_t sampled;             // Partitions whose read version was sampled (partitioned clocks)
+    uint rvs[clock_partitions];   // Per-partition read versions
+    uint wvs[clock_partitions];   // Per-partition write versions, set at commit
+    size_t slot;                  // Thread-local clock of the transaction's thread
+    uint seen[tlc_slots];         // Cached thread-local clocks, only refreshed on abort (kept by the thread context)
+    bool visible;                 // Whether the reads are visible
+    vector<size_t> marked;        // Reader stripes marked by the transaction
     unordered_map<void*, Write*> writes;
+    uint64_t write_filter[2]; // Bloom filter of the keys of 'writes', see 'mayHaveWritten'
     vector<void*> order_writes;
     unordered_set<pair<shared_ptr<WordLock>, shared_ptr<MemorySegment>>, hash_pair> reads;
     unordered_map<void*, shared_ptr<MemorySegment>> allocated;
     bool removed;
+    ThreadContext* ctx;
+    uint64_t cm_ts; // Contention manager priority, lower wins; 'no_priority' until the transaction turns long, kept across aborts by a thread context
+    uint32_t polls; // Accesses so far, paces the 'isDoomed' checks
+    vector<shared_ptr<WordLock>> owned;
+    vector<WordLock*> flat_reads; // Word locks of 'reads', in read order, for the bulk validation
     TransactionObject(uint t_id, bool is_ro, uint rv);
     ~TransactionObject();
 };
 
 
+/** Bump allocator for the private word buffers of a transaction, reset when the transaction ends.
+**/
+class WordArena {
+public:
+    vector<void*> chunks;
+    size_t current;
+    size_t used;
+    WordArena();
+    ~WordArena();
+    WordArena(const WordArena&) = delete;
+    WordArena& operator=(const WordArena&) = delete;
+    void* allocate(size_t size, size_t align);
+    void reset();
+};
+
+class TxStats {
+public:
+    uint64_t commits;
+    uint64_t aborts;
+    TxStats();
+};
+
+class Region;
+class Persist;
+class ValidatePool;
+class Tracer;
+class ConflictProfiler;
+
+/** Per-thread state, allocated once by 'tm_thread_enter' and reused by every transaction of the thread.
+**/
+class alignas(64) ThreadContext {
+public:
+    Region* region;
+    TransactionObject tran;
+    WordArena arena;
+    TxStats stats;
+    ThreadContext(Region* region);
+    ~ThreadContext();
+    ThreadContext(const ThreadContext&) = delete;
+    ThreadContext& operator=(const ThreadContext&) = delete;
+};
+
 class Region {
 public:
     atomic_uint clock;
+    ClockMode clock_mode;                    // TM_CLOCK
+    PartitionClock clocks[clock_partitions]; // Used instead of 'clock' with partitioned clocks
+    PartitionClock tlc_clocks[tlc_slots];    // Used instead of 'clock' with thread-local clocks
+    atomic<size_t> tlc_next;                 // Next thread slot to hand out
+    ReadMode read_mode;                      // TM_VISIBLE_READS
+    atomic<uint64_t> readers[reader_stripes]; // Reader bitmaps, by thread slot
+    ReaderSlot reader_slots[tlc_slots];
     unordered_map<void*, shared_ptr<MemorySegment>> memory;
     void* first_word;
     shared_mutex lock_mem;
+    shared_mutex lock_commit; // Held shared by committers during write-back once gated, exclusive for checkpoints and snapshots
+    atomic_bool commit_gated; // Whether committers take 'lock_commit' (durability, or since the first snapshot)
+    CommitSlot commit_slots[tlc_slots]; // Committers in write-back while not gated, by thread slot
     atomic_uint tran_counter;
     shared_mutex lock_trans;
     unordered_map<uint, shared_ptr<TransactionObject>> trans;
+    mutex lock_threads;
+    list<ThreadContext*> threads;
+    TxStats stats; // Statistics of the threads that already exited, and of the unregistered ones
+    bool report_stats; // Whether 'tm_destroy' prints the statistics (TM_STATS)
+    atomic<uint64_t> seg_counter;
+    Persist* persist; // Durability support, 'nullptr' if disabled
+    ValidatePool* validate_pool; // Helpers for the validation of large read sets, 'nullptr' if disabled
+    Tracer* tracer; // Event tracing, 'nullptr' if disabled
+    ConflictProfiler* conflicts; // Conflict hot-spot profiling, 'nullptr' if disabled
+    bool eager;             // Write/write conflicts detected at 'tm_write' (TM_EAGER_WW)
+    size_t cm_threshold;    // Owned words after which a transaction turns long (TM_CM_WRITES)
+    atomic<uint64_t> greedy_clock;
+    uint64_t generation; // Unique among the regions of the process, tags the thread contexts
     size_t size;
     size_t align;
     Region(size_t size, size_t align);
@@ -0,0 +1,418 @@
+// External headers
+#include <thread>
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include "persist.hpp"
+
+// -------------------------------------------------------------------------- //
+// File formats
+
+constexpr static uint32_t log_magic = 0x544d4c47;        // "TMLG"
+constexpr static uint64_t checkpoint_magic = 0x544d434b50543033; // "TMCKPT03"
+constexpr static size_t io_buffer_size = 1 << 20;
+
+struct LogHeader {
+    uint32_t magic;
+    uint32_t epoch; // Epoch of the checkpoint the record follows, older records are already in the checkpoint
+    uint64_t length;
+    uint64_t checksum;
+};
+
+// Checkpoint image: header and segment table, then the raw bytes of every segment,
+// each starting on a page boundary so that it can be mapped straight from the file.
+struct CheckpointHeader {
+    uint64_t magic;
+    uint64_t size;
+    uint64_t align;
+    uint64_t next_id;
+    uint64_t count;
+    uint64_t page;
+    uint64_t epoch; // Incremented by every checkpoint, see 'LogHeader::epoch'
+};
+
+struct CheckpointSegment {
+    uint64_t id;
+    uint64_t address;
+    uint64_t size;
+    uint64_t offset; // Page-aligned position of the bytes in the image
+};
+
+static uint64_t checksum(const char* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char) data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const char* cursor = (const char*) data;
+    while (size > 0) {
+        ssize_t res = ::write(fd, cursor, size);
+        if (unlikely(res < 0)) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        cursor += res;
+        size -= res;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+    char* cursor = (char*) data;
+    while (size > 0) {
+        ssize_t res = ::read(fd, cursor, size);
+        if (unlikely(res <= 0)) {
+            if (res < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        cursor += res;
+        size -= res;
+    }
+    return true;
+}
+
+static size_t page_round(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+// -------------------------------------------------------------------------- //
+
+RecoveredSegment::RecoveredSegment(uint64_t id, void* data, size_t size) {
+    this->id = id;
+    this->data = data;
+    this->size = size;
+}
+
+Persist::Persist(const char* dir) {
+    this->dir = dir;
+    this->log_fd = -1;
+    this->group_delay = chrono::microseconds(0);
+    this->checkpoint_every = 100000;
+    this->epoch = 0;
+    this->next_lsn = 0;
+    this->durable_lsn = 0;
+    this->flushing = false;
+    this->since_checkpoint.store(0);
+    this->checkpointing.store(false);
+    this->commits = 0;
+    this->syncs = 0;
+    this->bytes = 0;
+    this->checkpoints = 0;
+}
+
+Persist::~Persist() {
+    if (this->log_fd >= 0)
+        ::close(this->log_fd);
+}
+
+Persist* persist_from_env() {
+    const char* dir = getenv("TM_PERSIST_DIR");
+    if (likely(dir == nullptr || *dir == '\0'))
+        return nullptr;
+    Persist* persist = new Persist(dir);
+    const char* delay = getenv("TM_GROUP_COMMIT_US");
+    if (delay != nullptr)
+        persist->group_delay = chrono::microseconds(strtoull(delay, nullptr, 10));
+    const char* every = getenv("TM_CHECKPOINT_EVERY");
+    if (every != nullptr)
+        persist->checkpoint_every = strtoull(every, nullptr, 10);
+    return persist;
+}
+
+/** Open (creating if needed) the directory and its redo log.
+ * @return Whether the log is ready for appends
+**/
+bool Persist::open() {
+    ::mkdir(this->dir.c_str(), 0755);
+    this->log_fd = ::open((this->dir + "/redo.log").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return this->log_fd >= 0;
+}
+
+/** Map a shared segment, at a given address when restoring one.
+ * @param size   Size of the segment (in bytes)
+ * @param at     Address the segment must be mapped at, 'nullptr' for anywhere
+ * @param fd     Checkpoint image to map the content from (copy-on-write), -1 for zero-filled memory
+ * @param offset Page-aligned offset of the content in the image
+ * @return Address of the mapped segment, 'nullptr' on failure
+**/
+void* Persist::map_segment(size_t size, void* at, int fd, uint64_t offset) {
+    int flags = MAP_PRIVATE | (fd < 0 ? MAP_ANONYMOUS : 0);
+    if (at != nullptr)
+        flags |= MAP_FIXED_NOREPLACE;
+    void* data = ::mmap(at, page_round(size), PROT_READ | PROT_WRITE, flags, fd, fd < 0 ? 0 : offset);
+    if (unlikely(data == MAP_FAILED))
+        return nullptr;
+    if (unlikely(at != nullptr && data != at)) { // Kernel without MAP_FIXED_NOREPLACE took it as a hint
+        ::munmap(data, page_round(size));
+        return nullptr;
+    }
+    return data;
+}
+
+void Persist::unmap_segment(void* data, size_t size) {
+    ::munmap(data, page_round(size));
+}
+
+/** Rebuild the segments from the last checkpoint and the redo log.
+ * @param size     Expected size of the first segment
+ * @param align    Expected alignment
+ * @param segments Restored segments, empty if there was nothing to recover
+ * @param next_id  Receives the next unused segment ID
+ * @return Whether recovery succeeded (or there was nothing to recover)
+**/
+bool Persist::recover(size_t size, size_t align, vector<RecoveredSegment>& segments, uint64_t& next_id) {
+    unordered_map<uint64_t, size_t> index; // Segment ID -> position in 'segments'
+    int fd = ::open((this->dir + "/checkpoint").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return true; // Fresh directory, any log left without a checkpoint predates the first segment
+    CheckpointHeader header;
+    if (unlikely(!read_all(fd, &header, sizeof(header)) || header.magic != checkpoint_magic || header.size != size || header.align != align)) {
+        ::close(fd);
+        return false;
+    }
+    next_id = header.next_id;
+    this->epoch = (uint32_t) header.epoch;
+    vector<CheckpointSegment> table(header.count);
+    if (unlikely(header.page != (uint64_t) sysconf(_SC_PAGESIZE) || !read_all(fd, table.data(), table.size() * sizeof(CheckpointSegment)))) {
+        ::close(fd);
+        return false;
+    }
+    // Map the image privately: nothing is read now, pages fault in when first touched
+    for (auto& entry: table) {
+        void* data = map_segment(entry.size, (void*) entry.address, fd, entry.offset);
+        if (unlikely(data == nullptr)) {
+            ::close(fd);
+            return false;
+        }
+        index[entry.id] = segments.size();
+        segments.emplace_back(entry.id, data, entry.size);
+    }
+    ::close(fd);
+    // Redo every complete record of the checkpoint's epoch, stopping at the first torn or corrupted one; the caller
+    // checkpoints right after, so that later records never land behind a bad one
+    fd = ::open((this->dir + "/redo.log").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return true;
+    vector<char> payload;
+    LogHeader log_header;
+    while (read_all(fd, &log_header, sizeof(log_header)) && log_header.magic == log_magic) {
+        payload.resize(log_header.length);
+        if (!read_all(fd, payload.data(), payload.size()) || checksum(payload.data(), payload.size()) != log_header.checksum)
+            break;
+        if (log_header.epoch != this->epoch) // Left over by a crash between a checkpoint and the truncation of the log
+            continue;
+        size_t pos = 0;
+        while (pos + sizeof(LogEntry) <= payload.size()) {
+            LogEntry* entry = (LogEntry*) (payload.data() + pos);
+            pos += sizeof(LogEntry);
+            if (entry->kind == (uint64_t) LogKind::write) {
+                if (likely(index.count(entry->segment) == 1)) {
+                    RecoveredSegment& seg = segments[index[entry->segment]];
+                    memcpy((char*) seg.data + entry->offset, payload.data() + pos, entry->size);
+                }
+                pos += entry->size;
+            } else if (entry->kind == (uint64_t) LogKind::alloc) {
+                void* data = map_segment(entry->size, (void*) entry->offset);
+                if (unlikely(data == nullptr)) {
+                    ::close(fd);
+                    return false;
+                }
+                index[entry->segment] = segments.size();
+                segments.emplace_back(entry->segment, data, entry->size);
+                next_id = max(next_id, entry->segment + 1);
+            } else if (entry->kind == (uint64_t) LogKind::free) {
+                if (likely(index.count(entry->segment) == 1)) {
+                    size_t at = index[entry->segment];
+                    unmap_segment(segments[at].data, segments[at].size);
+                    index.erase(entry->segment);
+                    if (at != segments.size() - 1) {
+                        segments[at] = segments.back();
+                        index[segments[at].id] = at;
+                    }
+                    segments.pop_back();
+                }
+            }
+        }
+    }
+    ::close(fd);
+    return true;
+}
+
+void log_entry(vector<char>& record, LogKind kind, uint64_t segment, uint64_t offset, uint64_t size, const void* data) {
+    LogEntry entry = {(uint64_t) kind, segment, offset, size};
+    record.insert(record.end(), (const char*) &entry, (const char*) &entry + sizeof(entry));
+    if (kind == LogKind::write)
+        record.insert(record.end(), (const char*) data, (const char*) data + size);
+}
+
+/** Append a redo record to the pending batch.
+ * @param record Record payload (sequence of entries)
+ * @return LSN of the record, to wait on for durability
+**/
+uint64_t Persist::append(const vector<char>& record) {
+    LogHeader header;
+    header.magic = log_magic;
+    header.epoch = this->epoch;
+    header.length = record.size();
+    header.checksum = checksum(record.data(), record.size());
+    lock_guard<mutex> guard(this->lock_log);
+    this->pending.insert(this->pending.end(), (const char*) &header, (const char*) &header + sizeof(header));
+    this->pending.insert(this->pending.end(), record.begin(), record.end());
+    ++this->commits;
+    return this->next_lsn++;
+}
+
+/** Wait until the record of the given LSN is durable, flushing a whole batch with one 'fdatasync' if no other thread is.
+ * @param lsn LSN of the record to wait for
+**/
+void Persist::wait_durable(uint64_t lsn) {
+    unique_lock<mutex> guard(this->lock_log);
+    while (this->durable_lsn <= lsn) {
+        if (this->flushing) {
+            this->cv_log.wait(guard);
+            continue;
+        }
+        // Become the flush leader for every record appended so far
+        this->flushing = true;
+        if (this->group_delay.count() > 0) {
+            guard.unlock();
+            this_thread::sleep_for(this->group_delay);
+            guard.lock();
+        }
+        vector<char> batch;
+        batch.swap(this->pending);
+        uint64_t upto = this->next_lsn;
+        guard.unlock();
+        if (unlikely(!write_all(this->log_fd, batch.data(), batch.size()) || ::fdatasync(this->log_fd) != 0))
+            cerr << "persist: unable to write the redo log: " << strerror(errno) << endl;
+        guard.lock();
+        ++this->syncs;
+        this->bytes += batch.size();
+        this->durable_lsn = max(this->durable_lsn, upto);
+        this->flushing = false;
+        this->cv_log.notify_all();
+    }
+}
+
+/** Write a checkpoint of every live segment, then truncate the redo log.
+ * Committing writers are held back for the duration, readers are not.
+ * @param reg Region to checkpoint
+ * @return Whether the checkpoint was written (or one was already in progress)
+**/
+bool Persist::checkpoint(Region* reg) {
+    if (this->checkpointing.exchange(true))
+        return true;
+    unique_lock<shared_mutex> gate(reg->lock_commit);
+    Image image(reg, this->epoch + 1);
+    string tmp = this->dir + "/checkpoint.tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    if (likely(ok)) {
+        ok = image.write(fd) && ::fdatasync(fd) == 0;
+        ::close(fd);
+    }
+    ok = ok && ::rename(tmp.c_str(), (this->dir + "/checkpoint").c_str()) == 0;
+    if (likely(ok)) {
+        int dir_fd = ::open(this->dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0) {
+            ::fsync(dir_fd);
+            ::close(dir_fd);
+        }
+        // Every appended record has been written back, hence is covered by the checkpoint
+        unique_lock<mutex> guard(this->lock_log);
+        while (this->flushing)
+            this->cv_log.wait(guard);
+        this->pending.clear();
+        this->durable_lsn = this->next_lsn;
+        ++this->epoch; // The records still in the log, if the truncation does not make it, are now skipped
+        if (unlikely(::ftruncate(this->log_fd, 0) != 0 || ::fdatasync(this->log_fd) != 0))
+            cerr << "persist: unable to truncate the redo log: " << strerror(errno) << endl;
+        ++this->checkpoints;
+        this->cv_log.notify_all();
+    } else {
+        cerr << "persist: unable to write the checkpoint: " << strerror(errno) << endl;
+    }
+    this->since_checkpoint.store(0);
+    gate.unlock();
+    this->checkpointing.store(false);
+    return ok;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Collect the live segments of a region and lay out their image, with the commit gate held.
+ * @param reg   Region to take the image of
+ * @param epoch Epoch to stamp the checkpoint with
+**/
+Image::Image(Region* reg, uint32_t epoch) {
+    {
+        unordered_set<MemorySegment*> seen;
+        shared_lock<shared_mutex> guard(reg->lock_mem);
+        for (auto& pair_seg: reg->memory) {
+            if (!pair_seg.second->is_freed.load() && seen.insert(pair_seg.second.get()).second)
+                this->live.push_back(pair_seg.second.get());
+        }
+    }
+    sort(this->live.begin(), this->live.end(), [](MemorySegment* a, MemorySegment* b) { return a->id < b->id; });
+    this->page = sysconf(_SC_PAGESIZE);
+    CheckpointHeader header = {checkpoint_magic, reg->size, reg->align, reg->seg_counter.load(), this->live.size(), this->page, epoch};
+    this->table.insert(this->table.end(), (const char*) &header, (const char*) &header + sizeof(header));
+    uint64_t offset = page_round(sizeof(header) + this->live.size() * sizeof(CheckpointSegment));
+    for (MemorySegment* seg: this->live) {
+        CheckpointSegment entry = {seg->id, (uint64_t) seg->data, seg->size, offset};
+        this->table.insert(this->table.end(), (const char*) &entry, (const char*) &entry + sizeof(entry));
+        offset += page_round(seg->size);
+    }
+    this->buffer.reserve(io_buffer_size + this->page);
+}
+
+/** Stream the image sequentially to a file descriptor (which need not be seekable).
+ * Does not allocate, so that it can run in a child forked from a multi-threaded process.
+ * @param fd File descriptor to write to
+ * @return Whether the whole image was written
+**/
+bool Image::write(int fd) {
+    bool ok = true;
+    uint64_t written = 0; // Bytes handed to 'fd' or to the buffer so far
+    this->buffer.clear();
+    auto flush = [&]() {
+        ok = ok && write_all(fd, this->buffer.data(), this->buffer.size());
+        this->buffer.clear();
+    };
+    auto put = [&](const void* data, size_t size) {
+        if (this->buffer.size() + size > io_buffer_size)
+            flush();
+        if (size > io_buffer_size) // Large segments bypass the buffer
+            ok = ok && write_all(fd, data, size);
+        else
+            this->buffer.insert(this->buffer.end(), (const char*) data, (const char*) data + size);
+        written += size;
+    };
+    auto pad = [&]() {
+        size_t padding = ((written + this->page - 1) & ~(this->page - 1)) - written;
+        if (this->buffer.size() + padding > io_buffer_size + this->page)
+            flush();
+        this->buffer.resize(this->buffer.size() + padding, 0);
+        written += padding;
+    };
+    put(this->table.data(), this->table.size());
+    pad();
+    for (MemorySegment* seg: this->live) {
+        put(seg->data, seg->size);
+        pad();
+    }
+    flush();
+    return ok;
+}
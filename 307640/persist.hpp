@@ -0,0 +1,102 @@
+#pragma once
+
+// External headers
+#include <condition_variable>
+#include <chrono>
+#include <string>
+
+// Internal headers
+#include "help.hpp"
+
+// -------------------------------------------------------------------------- //
+// Optional durability: write-ahead redo log with group commit, plus periodic checkpoints.
+// Enabled by setting TM_PERSIST_DIR to a directory on a local filesystem; knobs:
+//   TM_GROUP_COMMIT_US   Time a flush leader waits for more commits to join its batch (default 0)
+//   TM_CHECKPOINT_EVERY  Number of commits between two checkpoints (default 100000, 0 for none)
+
+enum class LogKind: uint64_t {
+    write = 0,
+    alloc = 1,
+    free = 2
+};
+
+/** One entry of a redo record; 'write' entries are followed by 'size' bytes of data.
+ * For 'alloc' entries, 'offset' holds the base address the segment must be mapped at.
+**/
+struct LogEntry {
+    uint64_t kind;
+    uint64_t segment;
+    uint64_t offset;
+    uint64_t size;
+};
+
+/** A segment restored by the recovery, already mapped at its original address.
+**/
+class RecoveredSegment {
+public:
+    uint64_t id;
+    void* data;
+    size_t size;
+    RecoveredSegment(uint64_t id, void* data, size_t size);
+};
+
+class Persist {
+public:
+    string dir;
+    int log_fd;
+    chrono::microseconds group_delay;
+    uint64_t checkpoint_every;
+    mutex lock_log;
+    condition_variable cv_log;
+    vector<char> pending;     // Records appended but not yet handed to a flush
+    uint64_t next_lsn;        // LSN of the next appended record
+    uint64_t durable_lsn;     // All records with a smaller LSN are durable
+    bool flushing;
+    atomic<uint64_t> since_checkpoint;
+    atomic_bool checkpointing;
+    uint64_t commits;
+    uint64_t syncs;
+    uint64_t bytes;
+    uint64_t checkpoints;
+    uint32_t epoch;           // Epoch of the last checkpoint, stamped on the appended records
+    Persist(const char* dir);
+    ~Persist();
+    Persist(const Persist&) = delete;
+    Persist& operator=(const Persist&) = delete;
+    bool open();
+    bool recover(size_t size, size_t align, vector<RecoveredSegment>& segments, uint64_t& next_id);
+    uint64_t append(const vector<char>& record);
+    void wait_durable(uint64_t lsn);
+    bool checkpoint(Region* reg);
+    static void* map_segment(size_t size, void* at, int fd = -1, uint64_t offset = 0);
+    static void unmap_segment(void* data, size_t size);
+};
+
+/** Image of the live segments of a region, in the checkpoint format.
+**/
+class Image {
+public:
+    vector<MemorySegment*> live;
+    vector<char> table;  // Header and segment table
+    vector<char> buffer; // Reserved up-front, so that 'write' never allocates
+    size_t page;
+    Image(Region* reg, uint32_t epoch);
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+    bool write(int fd);
+};
+
+/** Add one entry to a redo record under construction.
+ * @param record  Record payload to extend
+ * @param kind    Kind of entry
+ * @param segment ID of the target segment
+ * @param offset  Offset in the segment ('write'), or base address of the segment ('alloc')
+ * @param size    Size of the data ('write'), or of the segment ('alloc')
+ * @param data    Data to copy ('write' only)
+**/
+void log_entry(vector<char>& record, LogKind kind, uint64_t segment, uint64_t offset, uint64_t size, const void* data);
+
+/** Read the persistence configuration from the environment.
+ * @return Persistence instance, 'nullptr' if disabled
+**/
+Persist* persist_from_env();
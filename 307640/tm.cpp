@@ -13,20 +13,431 @@
  * Only the interface (i.e. exported symbols and semantic) must be preserved.
 **/
 
+extern "C" {
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+#include <conflict.hpp>
 #include <help.hpp>
+#include <persist.hpp>
 #include <tm.hpp>
+#include <trace.hpp>
+#include <validate.hpp>
 
 // -------------------------------------------------------------------------- //
 // Helper functions
 
-void removeT(shared_ptr<TransactionObject> tran, bool failed) {
+static thread_local ThreadContext* local_ctx = nullptr;
+static thread_local uint64_t local_gen = 0; // Generation of the region 'local_ctx' belongs to
+
+/** Get the context of the calling thread on the given region, without touching a context of a destroyed region.
+**/
+static inline ThreadContext* localContext(Region* reg) {
+    return local_gen == reg->generation ? local_ctx : nullptr;
+}
+
+/** Give a write its private word buffer, taken from the thread arena when there is one.
+**/
+void allocWord(TransactionObject* tran, Write* write, size_t align) {
+    if (likely(tran->ctx != nullptr)) {
+        write->data = tran->ctx->arena.allocate(align, align);
+        if (likely(write->data != nullptr))
+            return;
+    }
+    write->data = malloc(align);
+    write->owns_data = true;
+}
+
+/** Release the words a transaction owns in eager mode.
+**/
+void releaseOwned(TransactionObject* tran) {
+    for (auto& word_lock: tran->owned)
+        word_lock->owner.store(0, memory_order_release);
+    tran->owned.clear();
+}
+
+/** Number of pauses a transaction waits for the owner of a word before giving up itself.
+**/
+constexpr static int cm_patience = 12;
+
+/** Number of those pauses that only yield, the following ones sleep with exponential backoff.
+**/
+constexpr static int cm_spins = 4;
+
+/** Owner word of a word lock held by a transaction of the given priority, never 0.
+ * Owner, priority and doomed flag live in the same word so that a contender can only doom the
+ * owner it saw, and never a later one, nor an owner whose priority is not yet published.
+ * @param cm_ts Contention manager priority of the owner
+**/
+static inline uint64_t ownerWord(uint64_t cm_ts) {
+    return min(cm_ts, no_priority >> 1) << 1;
+}
+
+/** Take ownership of a word for writing (eager mode), arbitrated by a two-phase contention manager:
+ * short transactions only wait a little for the owner then abort themselves, long ones (past
+ * 'cm_threshold' owned words) get a timestamp and the older one wins, dooming the owner.
+ * @return Whether the word is now owned by the transaction
+**/
+bool acquireOwner(Region* reg, TransactionObject* tran, shared_ptr<WordLock> word_lock) {
+    if (unlikely(tran->cm_ts == no_priority && tran->owned.size() >= reg->cm_threshold))
+        tran->cm_ts = ++reg->greedy_clock;
+    for (int patience = 0; patience <= cm_patience; ++patience) {
+        uint64_t expected = 0;
+        if (likely(word_lock->owner.compare_exchange_strong(expected, ownerWord(tran->cm_ts), memory_order_acquire))) {
+            tran->owned.push_back(word_lock);
+            return true;
+        }
+        if ((expected & 1) == 0 && ownerWord(tran->cm_ts) < expected) // Fails if the owner changed meanwhile
+            word_lock->owner.compare_exchange_strong(expected, expected | 1, memory_order_relaxed);
+        if (patience < cm_spins)
+            short_pause();
+        else // The owner is likely descheduled: give it the processor for real
+            this_thread::sleep_for(chrono::microseconds(1 << (patience - cm_spins)));
+    }
+    return false;
+}
+
+/** Whether a higher-priority transaction asked this one to abort (eager mode).
+**/
+bool isDoomed(TransactionObject* tran) {
+    for (auto& word_lock: tran->owned) {
+        if (unlikely(word_lock->owner.load(memory_order_relaxed) & 1))
+            return true;
+    }
+    return false;
+}
+
+/** Number of 'tm_read'/'tm_write' calls between two checks of 'isDoomed', which scans every owned word.
+**/
+constexpr static uint32_t doom_poll = 16;
+
+/** Whether a transaction lost one of its words to a higher-priority one, checked every 'doom_poll' accesses (eager mode).
+**/
+static inline bool pollDoomed(Region* reg, TransactionObject* tran) {
+    return unlikely(reg->eager) && !tran->owned.empty() && ++tran->polls % doom_poll == 0 && isDoomed(tran);
+}
+
+/** Clock partition of a segment.
+**/
+static inline size_t partitionOf(shared_ptr<MemorySegment> const& seg) {
+    return seg->id % clock_partitions;
+}
+
+static thread_local Region* tlc_region = nullptr;
+static thread_local size_t tlc_slot = 0;
+
+/** Thread-local clock slot of the calling thread, handed out on first use.
+**/
+size_t threadSlot(Region* reg) {
+    if (unlikely(tlc_region != reg)) {
+        tlc_slot = reg->tlc_next.fetch_add(1) % tlc_slots;
+        tlc_region = reg;
+    }
+    return tlc_slot;
+}
+
+/** Enter the write-back of a commit: shared on 'lock_commit' once gated, otherwise only announced in the thread's slot.
+ * @return Slot the commit is announced in, 'nullptr' if 'lock_commit' is held instead
+**/
+static CommitSlot* enterWriteBack(Region* reg) {
+    if (likely(!reg->commit_gated.load(memory_order_acquire))) {
+        CommitSlot* slot = &reg->commit_slots[threadSlot(reg)];
+        slot->active.fetch_add(1);
+        if (likely(!reg->commit_gated.load())) // Ordered after the announce, see 'gateCommits'
+            return slot;
+        slot->active.fetch_sub(1, memory_order_release);
+    }
+    reg->lock_commit.lock_shared();
+    return nullptr;
+}
+
+/** Leave the write-back of a commit.
+ * @param slot Slot returned by 'enterWriteBack'
+**/
+static void leaveWriteBack(Region* reg, CommitSlot* slot) {
+    if (likely(slot != nullptr))
+        slot->active.fetch_sub(1, memory_order_release);
+    else
+        reg->lock_commit.unlock_shared();
+}
+
+/** Make every later commit take 'lock_commit' shared, and wait for the ones already in write-back without it.
+ * Once this returns, holding 'lock_commit' exclusive excludes every write-back.
+**/
+static void gateCommits(Region* reg) {
+    if (likely(reg->commit_gated.load(memory_order_acquire)))
+        return;
+    reg->commit_gated.store(true);
+    for (auto& slot: reg->commit_slots) {
+        while (slot.active.load(memory_order_acquire) != 0)
+            short_pause();
+    }
+}
+
+/** Fill the cache of thread-local clocks of a transaction.
+**/
+void sampleSeen(Region* reg, TransactionObject* tran) {
+    for (size_t t = 0; t < tlc_slots; ++t)
+        tran->seen[t] = reg->tlc_clocks[t].clock.load();
+}
+
+/** Sample the read version(s) of a starting transaction.
+ * @param cached Whether the transaction descriptor carries the thread-local clocks seen by its thread so far
+**/
+void startVersions(Region* reg, TransactionObject* tran, bool cached) {
+    tran->sampled = 0;
+    if (likely(reg->clock_mode == ClockMode::global)) {
+        tran->rv = reg->clock.load();
+        return;
+    }
+    tran->rv = 0;
+    if (reg->clock_mode == ClockMode::tlc) {
+        tran->slot = threadSlot(reg);
+        if (!cached)
+            sampleSeen(reg, tran);
+        return;
+    }
+    if (tran->is_ro) {
+        // No read set to revalidate later on: sample every partition up-front
+        for (size_t p = 0; p < clock_partitions; ++p)
+            tran->rvs[p] = reg->clocks[p].clock.load();
+        tran->sampled = (UINT32_C(1) << clock_partitions) - 1;
+    }
+}
+
+/** Read version of a transaction for the words of a segment, sampling its partition on first use.
+ * Reads done so far must still hold when sampling a new partition: a writer may have bumped the new
+ * partition's clock while still holding, or after writing, words already read in another partition.
+ * @param rv Receives the read version
+ * @return Whether the transaction can continue
+**/
+bool readVersion(Region* reg, TransactionObject* tran, shared_ptr<MemorySegment> const& seg, uint* rv) {
+    if (likely(reg->clock_mode != ClockMode::partitioned)) {
+        *rv = tran->rv;
+        return true;
+    }
+    size_t p = partitionOf(seg);
+    uint32_t bit = UINT32_C(1) << p;
+    if (likely(tran->sampled & bit)) {
+        *rv = tran->rvs[p];
+        return true;
+    }
+    tran->rvs[p] = reg->clocks[p].clock.load();
+    tran->sampled |= bit;
+    *rv = tran->rvs[p];
+    for (auto& read: tran->reads) {
+        if (read.first->version.load() > tran->rvs[partitionOf(read.second)])
+            return false;
+        if (unlikely(!read.first->lock.try_lock()))
+            return false;
+        read.first->lock.unlock();
+    }
+    return true;
+}
+
+/** Read version a read word must not exceed at commit.
+**/
+static inline uint readBound(Region* reg, TransactionObject* tran, shared_ptr<MemorySegment> const& seg) {
+    return likely(reg->clock_mode != ClockMode::partitioned) ? tran->rv : tran->rvs[partitionOf(seg)];
+}
+
+/** Whether a word version belongs to the snapshot of a transaction.
+ * With thread-local clocks, the version must not be newer than the cached clock of its writer's slot;
+ * the whole cache is refreshed when it is not, so that the retry does not trip on the other stale slots one by one.
+ * @param version Version of the word
+ * @param rv      Read version from 'readVersion' or 'readBound' (unused with thread-local clocks)
+**/
+static inline bool readable(Region* reg, TransactionObject* tran, uint64_t version, uint rv) {
+    if (likely(reg->clock_mode != ClockMode::tlc))
+        return version <= rv;
+    size_t slot = version >> 32;
+    if (slot == 0 || (uint) version <= tran->seen[slot - 1])
+        return true;
+    sampleSeen(reg, tran);
+    return false;
+}
+
+/** Version to stamp on the words a committing transaction writes in a segment.
+**/
+static inline uint64_t writeVersion(Region* reg, TransactionObject* tran, shared_ptr<MemorySegment> const& seg) {
+    switch (reg->clock_mode) {
+    case ClockMode::partitioned:
+        return tran->wvs[partitionOf(seg)];
+    case ClockMode::tlc:
+        return (uint64_t) (tran->slot + 1) << 32 | tran->wv;
+    default:
+        return tran->wv;
+    }
+}
+
+/** Take the write version(s) of a committing transaction, with its write locks held.
+ * @return Whether the read set must be validated, i.e. another writer may have committed since it was read
+**/
+bool takeVersions(Region* reg, TransactionObject* tran) {
+    if (likely(reg->clock_mode == ClockMode::global)) {
+        tran->wv = ++reg->clock;
+        return tran->rv + 1u != tran->wv;
+    }
+    if (reg->clock_mode == ClockMode::tlc) {
+        // Slots can be shared by several threads, hence still an atomic increment (but uncontended)
+        tran->wv = ++reg->tlc_clocks[tran->slot].clock;
+        return true;
+    }
+    uint32_t written = 0;
+    for (auto& write: tran->writes)
+        written |= UINT32_C(1) << partitionOf(write.second->segment);
+    bool validate = false;
+    for (size_t p = 0; p < clock_partitions; ++p) {
+        uint32_t bit = UINT32_C(1) << p;
+        if (written & bit) {
+            tran->wvs[p] = ++reg->clocks[p].clock;
+            validate |= (tran->sampled & bit) && tran->wvs[p] != tran->rvs[p] + 1u;
+        } else if (tran->sampled & bit) {
+            validate |= reg->clocks[p].clock.load() != tran->rvs[p];
+        }
+    }
+    return validate;
+}
+
+/** Record a new key of the write set in its Bloom filter: one bit in each filter word, from two slices of one hash.
+**/
+static inline void noteWrite(TransactionObject* tran, void const* word) {
+    uint64_t hash = (uintptr_t) word * UINT64_C(0x9E3779B97F4A7C15);
+    tran->write_filter[0] |= UINT64_C(1) << (hash >> 58);
+    tran->write_filter[1] |= UINT64_C(1) << ((hash >> 52) & 63);
+}
+
+/** Whether the write set may hold a key, false meaning that it surely does not.
+**/
+static inline bool mayHaveWritten(TransactionObject const* tran, void const* word) {
+    uint64_t hash = (uintptr_t) word * UINT64_C(0x9E3779B97F4A7C15);
+    return ((tran->write_filter[0] >> (hash >> 58)) & (tran->write_filter[1] >> ((hash >> 52) & 63)) & 1) != 0;
+}
+
+/** Record an event of the calling thread, if tracing is enabled.
+**/
+static inline void trace(Region* reg, TraceKind kind, uint64_t arg) {
+    if (unlikely(reg->tracer != nullptr))
+        reg->tracer->record(kind, arg);
+}
+
+/** Report a conflict on a word to the profiler, if enabled.
+**/
+static inline void conflict(Region* reg, ConflictKind kind, shared_ptr<MemorySegment> const& seg, void const* word) {
+    if (unlikely(reg->conflicts != nullptr) && reg->conflicts->sample())
+        reg->conflicts->record(kind, seg->id, (uintptr_t) word - (uintptr_t) seg->data);
+}
+
+static_assert(reader_stripes == 4096, "'stripeOf' keeps the top 12 bits of the hash");
+
+/** Reader stripe of a word (Fibonacci hashing).
+**/
+static inline size_t stripeOf(void const* word) {
+    return ((uintptr_t) word * UINT64_C(0x9E3779B97F4A7C15)) >> 52;
+}
+
+/** Recent abort rate of the calling thread (out of 'rate_one'), and whether it reads visibly (adaptive mode).
+**/
+static thread_local uint abort_rate = 0;
+static thread_local bool adaptive_visible = false;
+
+constexpr static uint rate_one = 1024;
+/** Abort rates above which a thread turns its reads visible, and below which it turns them back invisible.
+**/
+constexpr static uint visible_above = 256;
+constexpr static uint visible_below = 64;
+
+/** Decide whether a starting transaction reads visibly, and clear the doomed flag of its slot.
+**/
+void startReads(Region* reg, TransactionObject* tran) {
+    tran->visible = false;
+    if (likely(reg->read_mode == ReadMode::invisible))
+        return;
+    if (reg->read_mode == ReadMode::adaptive) {
+        if (adaptive_visible ? abort_rate < visible_below : abort_rate > visible_above)
+            adaptive_visible = !adaptive_visible;
+        if (!adaptive_visible)
+            return;
+    }
+    tran->slot = threadSlot(reg);
+    tran->visible = true;
+    reg->reader_slots[tran->slot].doomed.store(false, memory_order_relaxed);
+}
+
+/** Mark a word as read by a visible reader; must happen before its version is read.
+**/
+static inline void markRead(Region* reg, TransactionObject* tran, void const* word) {
+    size_t stripe = stripeOf(word);
+    uint64_t bit = UINT64_C(1) << tran->slot;
+    if (reg->readers[stripe].load(memory_order_relaxed) & bit)
+        return;
+    reg->readers[stripe].fetch_or(bit);
+    tran->marked.push_back(stripe);
+}
+
+/** Whether a committed writer flagged the (visible) reads of a transaction as overwritten.
+**/
+static inline bool readerDoomed(Region* reg, TransactionObject* tran) {
+    return tran->visible && reg->reader_slots[tran->slot].doomed.load(memory_order_relaxed);
+}
+
+/** Flag the visible readers of the words a committing transaction wrote; must happen after the new versions are stored.
+ * Stripes and slots can be shared, so readers may be flagged spuriously: flags only make them abort earlier.
+**/
+void flagReaders(Region* reg, TransactionObject* tran) {
+    uint64_t self = tran->visible ? UINT64_C(1) << tran->slot : 0;
+    for (void* word: tran->order_writes) {
+        uint64_t readers = reg->readers[stripeOf(word)].load() & ~self;
+        while (readers != 0) {
+            reg->reader_slots[__builtin_ctzll(readers)].doomed.store(true, memory_order_relaxed);
+            readers &= readers - 1;
+        }
+    }
+}
+
+/** Unmark the stripes read by an ending transaction, and account its outcome in the thread's abort rate.
+**/
+void endReads(Region* reg, TransactionObject* tran, bool failed) {
+    if (likely(reg->read_mode == ReadMode::invisible))
+        return;
+    abort_rate = (abort_rate * 7 + (failed ? rate_one : 0)) / 8;
+    uint64_t mask = ~(UINT64_C(1) << tran->slot);
+    for (size_t stripe: tran->marked)
+        reg->readers[stripe].fetch_and(mask);
+    tran->marked.clear();
+}
+
+/** Minimum read set size for the bulk validation.
+**/
+constexpr static size_t bulk_reads = 64;
+
+/** Validate the read set of a committing transaction in bulk, when it has a single read version.
+ * Goes over the flat array of read word locks instead of the (pointer-chasing) read set.
+ * @return Whether every read is known to be still valid, otherwise the caller validates read by read
+**/
+bool bulkValidate(Region* reg, TransactionObject* tran) {
+    vector<WordLock*>& flat = tran->flat_reads;
+    if (reg->clock_mode != ClockMode::global || flat.size() < bulk_reads)
+        return false;
+    if (reg->validate_pool != nullptr)
+        return reg->validate_pool->validate(flat.data(), flat.size(), tran->rv);
+    return versions_below(flat.data(), flat.size(), tran->rv);
+}
+
+void removeT(TransactionObject* tran, bool failed) {
+    releaseOwned(tran);
     for (auto& write : tran->writes) {
-        if (likely(write.second->data != nullptr))
+        if (likely(write.second->owns_data))
             free(write.second->data);
         if (unlikely(write.second->type == WriteType::alloc)) {
             shared_ptr<MemorySegment> seg = write.second->segment;
             if (unlikely(failed)) {
-                free(seg->data);
+                if (unlikely(seg->mapped))
+                    Persist::unmap_segment(seg->data, seg->size);
+                else
+                    free(seg->data);
                 seg->writelocks.clear();
             }
         }
@@ -36,13 +447,43 @@ void removeT(shared_ptr<TransactionObject> tran, bool failed) {
         delete write.second;
     }
     tran->writes.clear();
+    tran->write_filter[0] = 0;
+    tran->write_filter[1] = 0;
     tran->order_writes.clear();
     tran->reads.clear();
+    tran->flat_reads.clear();
     tran->allocated.clear();
     tran->removed = true;
     return;
 }
 
+/** End the lifetime of a transaction: clean it up, account for it and give its descriptor back.
+**/
+void releaseT(Region* reg, TransactionObject* tran, bool failed) {
+    trace(reg, failed ? TraceKind::abort : TraceKind::commit, 0);
+    endReads(reg, tran, failed);
+    removeT(tran, failed);
+    ThreadContext* ctx = tran->ctx;
+    if (likely(ctx != nullptr)) {
+        if (unlikely(failed)) {
+            ++ctx->stats.aborts;
+        } else {
+            ++ctx->stats.commits;
+            tran->cm_ts = no_priority; // Next transaction of the thread starts short again
+        }
+        ctx->arena.reset();
+        return;
+    }
+    reg->lock_trans.lock();
+    if (unlikely(failed))
+        ++reg->stats.aborts;
+    else
+        ++reg->stats.commits;
+    reg->trans.erase(tran->t_id);
+    reg->lock_trans.unlock();
+    return;
+}
+
 void freeLocks(unordered_map<void*,list<unique_lock<recursive_timed_mutex>*>>* acq_locks) {
     for (auto const& pair : *acq_locks) {
         for (auto const& lock: pair.second) {
@@ -57,13 +498,89 @@ void freeLocks(unordered_map<void*,list<unique_lock<recursive_timed_mutex>*>>* a
 void cleanSeg(shared_ptr<MemorySegment> seg) {
     seg->lock_pointers.lock();
     seg->writelocks.clear();
-    free(seg->data);
+    if (unlikely(seg->mapped))
+        Persist::unmap_segment(seg->data, seg->size);
+    else
+        free(seg->data);
     seg->lock_pointers.unlock();
     if (unlikely(!seg->is_freed))
         seg->is_freed = true;
     return;
 }
 
+/** Register a segment and its word locks in the region.
+**/
+void addSeg(Region* reg, shared_ptr<MemorySegment> seg) {
+    void* start_segment = seg->data;
+    for (size_t i = 0; i < seg->size; i+=reg->align) {
+        seg->writelocks[start_segment+i] = make_shared<WordLock>(start_segment+i);
+        reg->memory[start_segment+i] = seg;
+    }
+}
+
+/** Create a durable region: restore it from its directory, or start a fresh one, then checkpoint it.
+ * The checkpoint also drops whatever the recovery stopped at (torn or corrupted tail) from the log.
+**/
+shared_t recoverRegion(Region* reg) {
+    Persist* persist = reg->persist;
+    vector<RecoveredSegment> segments;
+    uint64_t next_id = 1;
+    if (unlikely(!persist->open() || !persist->recover(reg->size, reg->align, segments, next_id))) {
+        cerr << "persist: unable to recover from '" << persist->dir << "'" << endl;
+        for (auto& rec: segments)
+            Persist::unmap_segment(rec.data, rec.size);
+        delete persist;
+        delete reg;
+        return invalid_shared;
+    }
+    bool fresh = segments.empty();
+    if (fresh) {
+        void* data = Persist::map_segment(reg->size, nullptr);
+        if (unlikely(data == nullptr)) {
+            delete persist;
+            delete reg;
+            return invalid_shared;
+        }
+        segments.emplace_back(0, data, reg->size);
+    }
+    reg->seg_counter.store(next_id);
+    for (auto& rec: segments) {
+        shared_ptr<MemorySegment> seg = make_shared<MemorySegment>(rec.size);
+        seg->id = rec.id;
+        seg->data = rec.data;
+        seg->mapped = true;
+        addSeg(reg, seg);
+        if (rec.id == 0)
+            reg->first_word = rec.data;
+    }
+    if (unlikely(!persist->checkpoint(reg))) {
+        tm_destroy(reg);
+        return invalid_shared;
+    }
+    return reg;
+}
+
+/** Build the redo record of a transaction that is about to write back, in write-back order.
+**/
+void logT(Region* reg, TransactionObject* tran, vector<char>& record) {
+    unordered_set<Write*> mapped; // Segments allocated-then-freed: first occurrence maps, second frees
+    for (void* addr: tran->order_writes) {
+        Write* w = tran->writes[addr];
+        if (likely(w->type == WriteType::write)) {
+            log_entry(record, LogKind::write, w->segment->id, (char*) addr - (char*) w->segment->data, reg->align, w->data);
+        } else if (unlikely(w->type == WriteType::alloc)) {
+            log_entry(record, LogKind::alloc, w->segment->id, (uint64_t) w->segment->data, w->segment->size, nullptr);
+        } else if (unlikely(w->type == WriteType::free)) {
+            if (w->allocated || mapped.count(w) == 1) {
+                log_entry(record, LogKind::free, w->segment->id, 0, 0, nullptr);
+            } else {
+                log_entry(record, LogKind::alloc, w->segment->id, (uint64_t) w->segment->data, w->segment->size, nullptr);
+                mapped.insert(w);
+            }
+        }
+    }
+}
+
 // -------------------------------------------------------------------------- //
 
 /** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
@@ -76,19 +593,43 @@ shared_t tm_create(size_t size, size_t align) noexcept {
     if (unlikely(!reg)) {
         return invalid_shared;
     }
+    const char* eager = getenv("TM_EAGER_WW");
+    reg->eager = eager != nullptr && atoi(eager) != 0;
+    const char* cm_writes = getenv("TM_CM_WRITES");
+    reg->cm_threshold = cm_writes != nullptr ? strtoul(cm_writes, nullptr, 10) : 4;
+    const char* stats = getenv("TM_STATS");
+    reg->report_stats = stats != nullptr && atoi(stats) != 0;
+    const char* clock = getenv("TM_CLOCK");
+    if (clock != nullptr && strcmp(clock, "partitioned") == 0)
+        reg->clock_mode = ClockMode::partitioned;
+    else if (clock != nullptr && strcmp(clock, "tlc") == 0)
+        reg->clock_mode = ClockMode::tlc;
+    const char* visible = getenv("TM_VISIBLE_READS");
+    if (visible != nullptr && strcmp(visible, "on") == 0)
+        reg->read_mode = ReadMode::visible;
+    else if (visible != nullptr && strcmp(visible, "adaptive") == 0)
+        reg->read_mode = ReadMode::adaptive;
+    reg->validate_pool = validate_pool_from_env();
+    reg->tracer = tracer_from_env();
+    reg->conflicts = conflicts_from_env();
+    reg->persist = persist_from_env();
+    if (unlikely(reg->persist != nullptr)) {
+        reg->commit_gated.store(true); // Checkpoints exclude write-backs
+        return recoverRegion(reg);
+    }
     shared_ptr<MemorySegment> first = make_shared<MemorySegment>(size);
     if (unlikely(!first)) {
-        free(reg);
+        delete reg;
         return invalid_shared;
     }
     if (unlikely(posix_memalign(&(first->data), align, size) != 0)) {
-        free(reg);
+        delete reg;
         return invalid_shared;
     }
     memset(first->data, 0, size);
     void* start_segment = first->data;
     for (size_t i = 0; i < size; i+=align) {
-        first->writelocks[start_segment+i] = make_shared<WordLock>();
+        first->writelocks[start_segment+i] = make_shared<WordLock>(start_segment+i);
     }
     for (size_t i = 0; i < size; i+=align) {
         reg->memory[start_segment+i] = first;
@@ -102,6 +643,17 @@ shared_t tm_create(size_t size, size_t align) noexcept {
 **/
 void tm_destroy(shared_t shared) noexcept {
     Region* reg = (Region*) shared;
+    if (unlikely(reg->tracer != nullptr))
+        reg->tracer->dump();
+    if (unlikely(reg->conflicts != nullptr))
+        reg->conflicts->report(reg->align);
+    if (unlikely(reg->persist != nullptr)) {
+        Persist* persist = reg->persist;
+        persist->checkpoint(reg);
+        cerr << "persist: " << persist->commits << " durable commits, " << persist->syncs << " fdatasync (" << (persist->syncs > 0 ? (double) persist->commits / persist->syncs : 0.) << " commits/batch), " << persist->bytes << " log bytes, " << persist->checkpoints << " checkpoints" << endl;
+        delete persist;
+        reg->persist = nullptr;
+    }
     for (auto &pair_seg: reg->memory) {
         if (likely(!pair_seg.second->is_freed.load())) {
             cleanSeg(pair_seg.second);
@@ -110,14 +662,97 @@ void tm_destroy(shared_t shared) noexcept {
     reg->memory.clear();
     for (auto &pair_tran: reg->trans) {
         if (unlikely(!pair_tran.second->removed)) {
-            removeT(pair_tran.second, false);
+            removeT(pair_tran.second.get(), false);
         }
     }
     reg->trans.clear();
+    for (ThreadContext* ctx: reg->threads) { // Other threads' 'local_ctx' go stale, told apart by the generation
+        reg->stats.commits += ctx->stats.commits;
+        reg->stats.aborts += ctx->stats.aborts;
+        delete ctx;
+    }
+    if (unlikely(reg->report_stats)) {
+        uint64_t attempts = reg->stats.commits + reg->stats.aborts;
+        cerr << "stats: " << reg->stats.commits << " commits, " << reg->stats.aborts << " aborts (" << (attempts > 0 ? 100. * reg->stats.aborts / attempts : 0.) << "% of attempts)" << endl;
+    }
+    if (local_gen == reg->generation)
+        local_ctx = nullptr;
+    reg->threads.clear();
     delete reg;
     return;
 }
 
+/** [thread-safe] Register the calling thread on the given shared memory region, optional.
+ * Transactions begun afterwards by this thread reuse a pre-allocated per-thread context.
+ * A thread has a context on one region at a time: registering on another region replaces it.
+ * Contexts of a region are freed by 'tm_destroy', whether or not their threads exited.
+ * @param shared Shared memory region the thread will run transactions on
+ * @return Whether the thread is now registered
+**/
+bool tm_thread_enter(shared_t shared) noexcept {
+    Region* reg = (Region*) shared;
+    if (unlikely(localContext(reg) != nullptr))
+        return true;
+    ThreadContext* ctx = new (nothrow) ThreadContext(reg);
+    if (unlikely(!ctx))
+        return false;
+    reg->lock_threads.lock();
+    reg->threads.push_back(ctx);
+    reg->lock_threads.unlock();
+    if (reg->clock_mode == ClockMode::tlc)
+        sampleSeen(reg, &ctx->tran);
+    local_ctx = ctx;
+    local_gen = reg->generation;
+    return true;
+}
+
+/** [thread-safe] Unregister the calling thread from the given shared memory region, with no running transaction.
+ * @param shared Shared memory region the thread was registered on
+**/
+void tm_thread_exit(shared_t shared) noexcept {
+    Region* reg = (Region*) shared;
+    ThreadContext* ctx = localContext(reg);
+    if (unlikely(ctx == nullptr))
+        return;
+    reg->lock_threads.lock();
+    reg->threads.remove(ctx);
+    reg->lock_threads.unlock();
+    reg->lock_trans.lock();
+    reg->stats.commits += ctx->stats.commits;
+    reg->stats.aborts += ctx->stats.aborts;
+    reg->lock_trans.unlock();
+    local_ctx = nullptr;
+    delete ctx;
+    return;
+}
+
+/** [thread-safe] Write a consistent point-in-time image of the shared memory region, in the checkpoint format, while transactions keep running.
+ * Committers are only held back while the process forks; a copy-on-write child streams the image.
+ * @param shared Shared memory region to take the image of
+ * @param fd     File descriptor to stream the image to (need not be seekable)
+ * @return Whether the whole image was written
+**/
+bool tm_snapshot_to_fd(shared_t shared, int fd) noexcept {
+    Region* reg = (Region*) shared;
+    pid_t child;
+    gateCommits(reg);
+    {
+        unique_lock<shared_mutex> gate(reg->lock_commit);
+        Image image(reg, 0); // Not a checkpoint: matches no redo log
+        child = fork();
+        if (child == 0) // Only this thread exists in the child, so no locking nor allocation from here
+            _exit(image.write(fd) ? 0 : 1);
+    }
+    if (unlikely(child < 0))
+        return false;
+    int status;
+    while (waitpid(child, &status, 0) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
 /** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
  * @param shared Shared memory region to query
  * @return Start address of the first allocated segment
@@ -150,11 +785,27 @@ size_t tm_align(shared_t shared) noexcept {
 tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
     // std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
     Region* reg = (Region*) shared;
+    if (unlikely(reg->tracer != nullptr)) {
+        reg->tracer->poll();
+        reg->tracer->record(TraceKind::begin, is_ro);
+    }
+    ThreadContext* ctx = localContext(reg);
+    if (likely(ctx != nullptr)) {
+        // Registered thread: reuse its descriptor, no allocation nor global map involved
+        TransactionObject* tran = &ctx->tran;
+        tran->is_ro = is_ro;
+        startVersions(reg, tran, true);
+        startReads(reg, tran);
+        tran->removed = false; // 'cm_ts' kept from an aborted attempt, so that retries grow older instead of restarting last
+        return (tx_t) tran;
+    }
     uint t_id = ++reg->tran_counter;
-    shared_ptr<TransactionObject> tran = make_shared<TransactionObject>(t_id, is_ro, reg->clock.load());
+    shared_ptr<TransactionObject> tran = make_shared<TransactionObject>(t_id, is_ro, 0);
     if (unlikely(!tran)) {
         return invalid_tx;
     }
+    startVersions(reg, tran.get(), false);
+    startReads(reg, tran.get());
     reg->lock_trans.lock();
     reg->trans[t_id] = tran;
     reg->lock_trans.unlock();
@@ -162,7 +813,7 @@ tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
     // int64_t dur = std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count();
     // if (dur > 100000)
     //     std::cout << "tm_begin time difference = " << dur << "[ns]" << std::endl;
-    return tran->t_id;
+    return (tx_t) tran.get();
 }
 
 /** [thread-safe] End the given transaction.
@@ -173,21 +824,24 @@ tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
 bool tm_end(shared_t shared, tx_t tx) noexcept {
     // std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
     Region* reg = (Region*) shared;
-    reg->lock_trans.lock_shared();
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx);
-    reg->lock_trans.unlock_shared();
+    TransactionObject* tran = (TransactionObject*) tx;
     if (likely(tran->is_ro)) {
-        removeT(tran, false);
+        releaseT(reg, tran, false);
         return true;
     }
+    if (unlikely((reg->eager && isDoomed(tran)) || readerDoomed(reg, tran))) {
+        releaseT(reg, tran, true);
+        return false;
+    }
     chrono::nanoseconds try_dur(100);
     unordered_map<void*, list<unique_lock<recursive_timed_mutex>*>> acq_locks;
     for (auto &write : tran->writes) {
         if (likely(write.second->type == WriteType::write || write.second->type == WriteType::dummy)) {
             unique_lock<recursive_timed_mutex>* new_lock = new unique_lock<recursive_timed_mutex>(write.second->lock->lock, defer_lock);
             if (unlikely(!(new_lock->try_lock_for(try_dur)))) {
-                removeT(tran, true);
+                conflict(reg, ConflictKind::commit_locked, write.second->segment, write.first);
                 freeLocks(&acq_locks);
+                releaseT(reg, tran, true);
                 return false;
             }
             acq_locks[write.first].push_back(new_lock);
@@ -195,18 +849,18 @@ bool tm_end(shared_t shared, tx_t tx) noexcept {
                 acq_locks[write.first].push_back(new unique_lock<recursive_timed_mutex>(write.second->lock->lock));
         }
     }
-    tran->wv = ++reg->clock;
-    if (unlikely(tran->rv + 1u != tran->wv)) {
+    if (unlikely(takeVersions(reg, tran)) && !bulkValidate(reg, tran)) {
         // TODO: understand what "We also verify that these memory locations have not been locked by other threads" means
         //  Should we lock read locations too?
         for (auto &read : tran->reads) {
-            if (read.first->version > tran->rv) {
+            if (!readable(reg, tran, read.first->version.load(), readBound(reg, tran, read.second))) {
+                conflict(reg, ConflictKind::commit_stale, read.second, read.first->word);
                 if (read.first->is_freed.load()) {
                     if (read.second.unique())
                         cleanSeg(read.second);
                 }
                 freeLocks(&acq_locks);
-                removeT(tran, true);
+                releaseT(reg, tran, true);
                 return false;
             }
         }
@@ -219,17 +873,28 @@ bool tm_end(shared_t shared, tx_t tx) noexcept {
                     cleanSeg(write.second->segment);
                 else
                     write.second->segment.reset();
-                removeT(tran, true);
                 freeLocks(&acq_locks);
+                releaseT(reg, tran, true);
                 return false;
             }
         }
     }
     // Now we are sure we can commit
+    Persist* persist = reg->persist;
+    uint64_t lsn = 0;
+    vector<char> record;
+    if (unlikely(persist != nullptr)) {
+        logT(reg, tran, record);
+        if (record.empty())
+            persist = nullptr;
+    }
+    CommitSlot* slot = enterWriteBack(reg);
+    if (unlikely(persist != nullptr))
+        lsn = persist->append(record);
     for (void* addr: tran->order_writes) {
         Write* w = tran->writes[addr];
         if (likely(w->type == WriteType::write)) {
-            w->lock->version.store(tran->wv);
+            w->lock->version.store(writeVersion(reg, tran, w->segment));
             memcpy(addr, w->data, reg->align);
             acq_locks[addr].front()->unlock();
             delete acq_locks[addr].front();
@@ -246,7 +911,7 @@ bool tm_end(shared_t shared, tx_t tx) noexcept {
             reg->lock_mem.unlock();
         }
         else if (unlikely(w->type == WriteType::dummy)) {
-            w->lock->version.store(tran->wv);
+            w->lock->version.store(writeVersion(reg, tran, w->segment));
             acq_locks[addr].front()->unlock();
             delete acq_locks[addr].front();
             acq_locks[addr].pop_front();
@@ -256,7 +921,7 @@ bool tm_end(shared_t shared, tx_t tx) noexcept {
         else if (unlikely(w->type == WriteType::free)) {
             w->segment->is_freed.store(true);
             for (auto& free_lock: w->lock_frees) {
-                    free_lock->version.store(tran->wv);
+                    free_lock->version.store(writeVersion(reg, tran, w->segment));
                     free_lock->is_freed.store(true);
             }
             void* start_segment = w->segment->data;
@@ -290,7 +955,15 @@ bool tm_end(shared_t shared, tx_t tx) noexcept {
             }
         }
     }
-    removeT(tran, false);
+    if (unlikely(reg->read_mode != ReadMode::invisible))
+        flagReaders(reg, tran);
+    leaveWriteBack(reg, slot);
+    if (unlikely(persist != nullptr)) {
+        persist->wait_durable(lsn);
+        if (persist->checkpoint_every > 0 && persist->since_checkpoint.fetch_add(1) + 1 >= persist->checkpoint_every)
+            persist->checkpoint(reg);
+    }
+    releaseT(reg, tran, false);
     // std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
     // int64_t dur = std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count();
     // if (dur > 100000)
@@ -311,20 +984,25 @@ bool tm_end(shared_t shared, tx_t tx) noexcept {
 bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
     // std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
     Region* reg = (Region*) shared;
-    reg->lock_trans.lock_shared();
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx);
-    reg->lock_trans.unlock_shared();
+    TransactionObject* tran = (TransactionObject*) tx;
+    trace(reg, TraceKind::read, (uintptr_t) source);
+    if (unlikely(readerDoomed(reg, tran) || pollDoomed(reg, tran))) {
+        releaseT(reg, tran, true);
+        return false;
+    }
     shared_ptr<MemorySegment> seg = nullptr;
     for (size_t i = 0; i < size; i+=reg->align) {
         void* word = const_cast<void*>(source) + i;
         bool taken_from_write = false;
         if (unlikely(!tran->is_ro)) {
-            if (tran->writes.count(word) == 1) {
+            if (mayHaveWritten(tran, word) && tran->writes.count(word) == 1) {
                 shared_ptr<WordLock> word_lock = tran->writes[word]->lock;
                 shared_ptr<MemorySegment> word_seg = tran->writes[word]->segment;
                 pair<shared_ptr<WordLock>, shared_ptr<MemorySegment>> seg_word_pair = make_pair(word_lock, word_seg);
-                if (tran->reads.count(seg_word_pair) == 0)
+                if (tran->reads.count(seg_word_pair) == 0) {
                     tran->reads.insert(seg_word_pair);
+                    tran->flat_reads.push_back(word_lock.get());
+                }
                 memcpy(target+i, tran->writes[word]->data, reg->align);
                 taken_from_write = true;
             }
@@ -338,37 +1016,49 @@ bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* ta
                 }
                 else {
                     reg->lock_mem.unlock_shared();
-                    removeT(tran, true);
+                    releaseT(reg, tran, true);
                     return false;
                 }
             }
             seg->lock_pointers.lock_shared();
             shared_ptr<WordLock> word_lock = seg->writelocks.at(word);
             seg->lock_pointers.unlock_shared();
-            uint write_ver = word_lock->version.load();
+            uint rv;
+            if (unlikely(!readVersion(reg, tran, seg, &rv))) {
+                releaseT(reg, tran, true);
+                return false;
+            }
+            if (unlikely(tran->visible))
+                markRead(reg, tran, word);
+            uint64_t write_ver = word_lock->version.load();
             // TODO: how does it work the post-validation here??? What they mean by "location’s versioned write-lock is free and has not changed"
             // should we check if we can have the lock too?
             // TODO: understand what bad can happen here with a freed segment: 
             // we can avoid to free the segment and wait until we have only one reference left?
             memcpy(target+i, word, reg->align);
-            uint new_ver = word_lock->version.load();
+            uint64_t new_ver = word_lock->version.load();
             if (unlikely(new_ver != write_ver)) {
-                removeT(tran, true);
+                conflict(reg, ConflictKind::read_changed, seg, word);
+                releaseT(reg, tran, true);
                 return false;
             }
-            if (unlikely(write_ver > tran->rv)) {
-                removeT(tran, true);
+            if (unlikely(!readable(reg, tran, write_ver, rv))) {
+                conflict(reg, ConflictKind::read_newer, seg, word);
+                releaseT(reg, tran, true);
                 return false;
             }
             if (unlikely(!word_lock->lock.try_lock())) {
-                removeT(tran, true);
+                conflict(reg, ConflictKind::read_locked, seg, word);
+                releaseT(reg, tran, true);
                 return false;
             }
             word_lock->lock.unlock();
             if (unlikely(!tran->is_ro)) {
                 pair<shared_ptr<WordLock>, shared_ptr<MemorySegment>> seg_word_pair = make_pair(word_lock, seg);
-                if (tran->reads.count(seg_word_pair) == 0)
-                        tran->reads.insert(seg_word_pair);
+                if (tran->reads.count(seg_word_pair) == 0) {
+                    tran->reads.insert(seg_word_pair);
+                    tran->flat_reads.push_back(word_lock.get());
+                }
             }
         }
     }
@@ -389,13 +1079,16 @@ bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* ta
 bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
     //std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
     Region* reg = (Region*) shared;
-    reg->lock_trans.lock_shared();
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx);
-    reg->lock_trans.unlock_shared();
+    TransactionObject* tran = (TransactionObject*) tx;
+    trace(reg, TraceKind::write, (uintptr_t) target);
+    if (unlikely(pollDoomed(reg, tran))) {
+        releaseT(reg, tran, true);
+        return false;
+    }
     shared_ptr<MemorySegment> seg = nullptr;
     for (size_t i = 0; i < size; i+=reg->align) {
         void* word = target + i;
-        if (unlikely(tran->writes.count(word) == 1)) {
+        if (unlikely(mayHaveWritten(tran, word) && tran->writes.count(word) == 1)) {
             memcpy(tran->writes[word]->data, source + i, reg->align);
             if (tran->writes[word]->type==WriteType::dummy)
                 tran->writes[word]->type = WriteType::write;
@@ -409,15 +1102,21 @@ bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* t
                 }
                 else {
                     reg->lock_mem.unlock_shared();
-                    removeT(tran, true);
+                    releaseT(reg, tran, true);
                     return false;
                 }
             }
             seg->lock_pointers.lock_shared();
             shared_ptr<WordLock> word_lock = seg->writelocks.at(word);
             seg->lock_pointers.unlock_shared();
+            if (unlikely(reg->eager) && !acquireOwner(reg, tran, word_lock)) {
+                conflict(reg, ConflictKind::write_owned, seg, word);
+                releaseT(reg, tran, true);
+                return false;
+            }
             tran->writes[word] = new Write(word_lock, seg, WriteType::write);
-            tran->writes[word]->data = malloc(reg->align);
+            noteWrite(tran, word);
+            allocWord(tran, tran->writes[word], reg->align);
             memcpy(tran->writes[word]->data, source + i, reg->align);
         }
         if (unlikely(none_of(tran->order_writes.begin(), tran->order_writes.end(), [&word](void* const& elem) { return word == elem; })))
@@ -439,28 +1138,36 @@ bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* t
 Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
     // std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
     Region* reg = (Region*) shared;
-    reg->lock_trans.lock_shared();
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx);
-    reg->lock_trans.unlock_shared();
+    TransactionObject* tran = (TransactionObject*) tx;
     shared_ptr<MemorySegment> new_seg = make_shared<MemorySegment>(size);
     if (unlikely(!new_seg)) {
         return Alloc::nomem;
     }
-    if (unlikely(posix_memalign(&(new_seg->data), reg->align, size) != 0)) {
+    new_seg->id = reg->seg_counter++;
+    if (unlikely(reg->persist != nullptr)) {
+        // Durable segments are mapped so that recovery can restore them at the same address
+        new_seg->data = Persist::map_segment(size, nullptr);
+        if (unlikely(new_seg->data == nullptr))
+            return Alloc::nomem;
+        new_seg->mapped = true;
+    } else if (unlikely(posix_memalign(&(new_seg->data), reg->align, size) != 0)) {
         return Alloc::nomem;
     }
     memset(new_seg->data, 0, size);
     tran->writes[new_seg.get()] = new Write(nullptr, new_seg, WriteType::alloc);
+    noteWrite(tran, new_seg.get());
     tran->order_writes.push_back(new_seg.get());
     void* start_segment = new_seg->data;
     tran->allocated[start_segment] = new_seg;
     for (size_t i = 0; i < size; i+=reg->align) {
-        new_seg->writelocks[start_segment+i] = make_shared<WordLock>();
+        new_seg->writelocks[start_segment+i] = make_shared<WordLock>(start_segment+i);
         tran->writes[start_segment+i] = new Write(new_seg->writelocks[start_segment+i], new_seg, WriteType::dummy);
-        tran->writes[start_segment+i]->data = malloc(reg->align);
+        noteWrite(tran, start_segment+i);
+        allocWord(tran, tran->writes[start_segment+i], reg->align);
         tran->order_writes.push_back(start_segment+i);
     }
     *target = new_seg->data;
+    trace(reg, TraceKind::alloc, (uintptr_t) new_seg->data);
     // std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
     // std::cout << "tm_alloc time difference = " << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() << "[ns]" << std::endl;
     return Alloc::success;
@@ -476,9 +1183,8 @@ bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
     // std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
     Region* reg = (Region*) shared;
     shared_ptr<MemorySegment> seg = nullptr;
-    reg->lock_trans.lock_shared();
-    shared_ptr<TransactionObject> tran = reg->trans.at(tx);
-    reg->lock_trans.unlock_shared();
+    TransactionObject* tran = (TransactionObject*) tx;
+    trace(reg, TraceKind::free, (uintptr_t) target);
     if (likely(tran->allocated.count(target) == 1)) {
         seg = tran->allocated[target];
         tran->writes[seg.get()]->type = WriteType::free;
@@ -489,10 +1195,11 @@ bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
             seg = reg->memory.at(target);
             reg->lock_mem.unlock_shared();
             tran->writes[seg.get()] = new Write(nullptr, seg, WriteType::free);
+            noteWrite(tran, seg.get());
         }
         else {
             reg->lock_mem.unlock_shared();
-            removeT(tran, true);
+            releaseT(reg, tran, true);
             return false;
         }
     }
@@ -500,6 +1207,7 @@ bool tm_free(shared_t shared, tx_t tx, void* target) noexcept {
     for (pair<void*, shared_ptr<WordLock>> wordlock: seg->writelocks) {
         if (likely(tran->writes.count(wordlock.first)!=1)) {
             tran->writes[wordlock.first] = new Write(wordlock.second, seg, WriteType::dummy);
+            noteWrite(tran, wordlock.first);
         }
         tran->writes[wordlock.first]->will_be_freed = true;
         tran->writes[seg.get()]->lock_frees.push_back(wordlock.second);
@@ -0,0 +1,181 @@
+// External headers
+#include <cstdio>
+extern "C" {
+#include <signal.h>
+#include <unistd.h>
+}
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Internal headers
+#include "trace.hpp"
+
+// -------------------------------------------------------------------------- //
+// Time stamps
+
+static inline uint64_t read_tsc() {
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// -------------------------------------------------------------------------- //
+// Dump signal, handled while at least one tracer exists
+
+static atomic_bool dump_requested{false};
+static mutex lock_handler;
+static size_t live_tracers = 0;         // Guarded by 'lock_handler'
+static struct sigaction previous_action; // Action SIGUSR2 had before the first tracer, chained and restored
+
+static void on_dump_signal(int sig, siginfo_t* info, void* context) {
+    dump_requested.store(true, memory_order_relaxed);
+    if (previous_action.sa_flags & SA_SIGINFO)
+        previous_action.sa_sigaction(sig, info, context);
+    else if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN)
+        previous_action.sa_handler(sig);
+}
+
+/** Install the dump handler with the first tracer, keeping the previous action.
+**/
+static void acquire_handler() {
+    lock_guard<mutex> lock(lock_handler);
+    if (live_tracers++ > 0)
+        return;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_dump_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigaction(SIGUSR2, &action, &previous_action);
+}
+
+/** Restore the previous action with the last tracer, as the library (hence the handler) may be unloaded next.
+**/
+static void release_handler() {
+    lock_guard<mutex> lock(lock_handler);
+    if (--live_tracers > 0)
+        return;
+    sigaction(SIGUSR2, &previous_action, nullptr);
+}
+
+// -------------------------------------------------------------------------- //
+// Per-thread buffers
+
+static atomic<uint64_t> tracer_counter{0};
+static thread_local uint64_t local_tracer = 0; // ID of the tracer 'local_buffer' belongs to, 0 for none
+static thread_local TraceBuffer* local_buffer = nullptr;
+
+TraceBuffer::TraceBuffer(uint64_t tid) {
+    this->head.store(0);
+    this->tid = tid;
+}
+
+Tracer::Tracer(string const& path) {
+    this->path = path;
+    this->id = ++tracer_counter;
+    this->tsc_start = read_tsc();
+    this->time_start = chrono::steady_clock::now();
+    acquire_handler();
+}
+
+Tracer::~Tracer() {
+    release_handler();
+    for (TraceBuffer* buffer: this->buffers)
+        delete buffer;
+}
+
+/** Buffer of the calling thread, allocated on its first event.
+**/
+TraceBuffer* Tracer::local() {
+    if (likely(local_tracer == this->id))
+        return local_buffer;
+    lock_guard<mutex> lock(this->lock_buffers);
+    TraceBuffer* buffer = new TraceBuffer(this->buffers.size() + 1);
+    this->buffers.push_back(buffer);
+    local_tracer = this->id;
+    local_buffer = buffer;
+    return buffer;
+}
+
+/** Record one event of the calling thread.
+ * @param kind Kind of event
+ * @param arg  Argument of the event, see 'TraceEvent'
+**/
+void Tracer::record(TraceKind kind, uint64_t arg) {
+    TraceBuffer* buffer = this->local();
+    uint64_t head = buffer->head.load(memory_order_relaxed);
+    TraceEvent& event = buffer->events[head % trace_capacity];
+    event.tsc = read_tsc();
+    event.arg = arg;
+    event.kind = kind;
+    buffer->head.store(head + 1, memory_order_release);
+}
+
+// -------------------------------------------------------------------------- //
+// Dump
+
+/** Dump the buffers if SIGUSR2 was received since the last poll.
+**/
+void Tracer::poll() {
+    if (unlikely(dump_requested.load(memory_order_relaxed)) && dump_requested.exchange(false))
+        this->dump();
+}
+
+/** Write every buffer to the trace file, as Chrome 'trace_event' JSON.
+ * Buffers may still be written meanwhile: the oldest slot of a full ring is skipped, being the next one overwritten.
+ * @return Whether the trace file was written
+**/
+bool Tracer::dump() {
+    static char const* const names[] = { "tx", "read", "write", "tx", "tx", "alloc", "free" };
+    double elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - this->time_start).count();
+    double tsc_per_us = elapsed > 0 ? (double) (read_tsc() - this->tsc_start) / elapsed : 1.;
+    FILE* file = fopen(this->path.c_str(), "w");
+    if (unlikely(file == nullptr)) {
+        cerr << "trace: unable to open '" << this->path << "'" << endl;
+        return false;
+    }
+    int pid = getpid();
+    uint64_t count = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    lock_guard<mutex> lock(this->lock_buffers);
+    for (TraceBuffer* buffer: this->buffers) {
+        uint64_t head = buffer->head.load(memory_order_acquire);
+        uint64_t first = head >= trace_capacity ? head - trace_capacity + 1 : 0;
+        for (uint64_t i = first; i < head; ++i) {
+            TraceEvent const& event = buffer->events[i % trace_capacity];
+            double ts = (double) (int64_t) (event.tsc - this->tsc_start) / tsc_per_us;
+            fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"tm\",\"pid\":%d,\"tid\":%lu,\"ts\":%.3f,", count++ > 0 ? ",\n" : "", names[(int) event.kind], pid, (unsigned long) buffer->tid, ts);
+            switch (event.kind) {
+            case TraceKind::begin:
+                fprintf(file, "\"ph\":\"B\",\"args\":{\"ro\":%lu}}", (unsigned long) event.arg);
+                break;
+            case TraceKind::commit:
+                fprintf(file, "\"ph\":\"E\",\"args\":{\"outcome\":\"commit\"}}");
+                break;
+            case TraceKind::abort:
+                fprintf(file, "\"ph\":\"E\",\"args\":{\"outcome\":\"abort\"}},\n");
+                fprintf(file, "{\"name\":\"abort\",\"cat\":\"tm\",\"pid\":%d,\"tid\":%lu,\"ts\":%.3f,\"ph\":\"i\",\"s\":\"t\"}", pid, (unsigned long) buffer->tid, ts);
+                break;
+            default:
+                fprintf(file, "\"ph\":\"i\",\"s\":\"t\",\"args\":{\"addr\":\"%#lx\"}}", (unsigned long) event.arg);
+                break;
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool written = ferror(file) == 0;
+    written = fclose(file) == 0 && written;
+    cerr << "trace: " << count << " events from " << this->buffers.size() << " threads " << (written ? "written to '" : "lost writing '") << this->path << "'" << endl;
+    return written;
+}
+
+Tracer* tracer_from_env() {
+    const char* prefix = getenv("TM_TRACE");
+    if (prefix == nullptr || *prefix == '\0')
+        return nullptr;
+    static atomic<uint64_t> regions{0};
+    return new Tracer(string(prefix) + "-" + to_string(getpid()) + "-" + to_string(++regions) + ".json");
+}
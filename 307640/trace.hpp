@@ -0,0 +1,73 @@
+#pragma once
+
+// External headers
+#include <chrono>
+#include <string>
+
+// Internal headers
+#include "help.hpp"
+
+// -------------------------------------------------------------------------- //
+// Optional event tracing: every thread records its transactional events, with TSC timestamps,
+// in its own ring buffer; the buffers are dumped as Chrome 'trace_event' JSON (chrome://tracing, Perfetto).
+// Enabled by setting TM_TRACE to a file prefix; the trace of a region goes to '<prefix>-<pid>-<n>.json'
+// at 'tm_destroy', or earlier upon SIGUSR2 (dumped by the next thread beginning a transaction).
+// The SIGUSR2 handler is only installed while a tracer exists; the previous action is chained, then restored.
+
+enum class TraceKind: uint8_t {
+    begin = 0,
+    read = 1,
+    write = 2,
+    commit = 3,
+    abort = 4,
+    alloc = 5,
+    free = 6
+};
+
+/** One traced event; 'arg' is the address of reads, writes, allocations and frees, the read-only flag of begins.
+**/
+struct TraceEvent {
+    uint64_t tsc;
+    uint64_t arg;
+    TraceKind kind;
+};
+
+/** Number of events kept per thread, the oldest ones are overwritten.
+**/
+constexpr static size_t trace_capacity = 1 << 16;
+
+/** Single-producer ring of events; readers take a snapshot of 'head' and skip what may have been overwritten.
+**/
+class TraceBuffer {
+public:
+    alignas(64) atomic<uint64_t> head; // Number of events ever recorded
+    uint64_t tid;
+    TraceEvent events[trace_capacity];
+    TraceBuffer(uint64_t tid);
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer& operator=(const TraceBuffer&) = delete;
+};
+
+class Tracer {
+public:
+    string path;
+    uint64_t id;                   // Process-unique, for the threads to tell their buffer of this tracer apart
+    mutex lock_buffers;
+    vector<TraceBuffer*> buffers;
+    uint64_t tsc_start;            // TSC and steady clock when tracing started, to calibrate the TSC
+    chrono::steady_clock::time_point time_start;
+    Tracer(string const& path);
+    ~Tracer();
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    void record(TraceKind kind, uint64_t arg);
+    void poll();
+    bool dump();
+private:
+    TraceBuffer* local();
+};
+
+/** Read the tracing configuration from the environment.
+ * @return Tracer instance, 'nullptr' if disabled
+**/
+Tracer* tracer_from_env();
@@ -0,0 +1,155 @@
+// External headers
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+// Internal headers
+#include "validate.hpp"
+
+// -------------------------------------------------------------------------- //
+// Version checks
+
+/** Distance (in word locks) at which the version words are prefetched.
+**/
+constexpr static size_t prefetch_ahead = 8;
+
+static bool versions_below_scalar(WordLock* const* locks, size_t count, uint64_t rv) {
+    for (size_t i = 0; i < count; ++i) {
+        if (likely(i + prefetch_ahead < count))
+            __builtin_prefetch(&locks[i + prefetch_ahead]->version);
+        if (locks[i]->version.load() > rv)
+            return false;
+    }
+    return true;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/** Gather the versions four word locks at a time; the lock addresses themselves are the gather indices.
+**/
+__attribute__((target("avx2")))
+static bool versions_below_avx2(WordLock* const* locks, size_t count, uint64_t rv) {
+    if (count < 4)
+        return versions_below_scalar(locks, count, rv);
+    const __m256i offset = _mm256_set1_epi64x((char const*) &locks[0]->version - (char const*) locks[0]);
+    const __m256i bound = _mm256_set1_epi64x((long long) rv);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        if (likely(i + prefetch_ahead + 4 <= count)) {
+            for (size_t j = i + prefetch_ahead; j < i + prefetch_ahead + 4; ++j)
+                __builtin_prefetch(&locks[j]->version);
+        }
+        __m256i addresses = _mm256_add_epi64(_mm256_loadu_si256((__m256i const*) (locks + i)), offset);
+        __m256i versions = _mm256_i64gather_epi64((long long const*) nullptr, addresses, 1);
+        __m256i over = _mm256_cmpgt_epi64(versions, bound);
+        if (unlikely(!_mm256_testz_si256(over, over)))
+            return false;
+    }
+    return versions_below_scalar(locks + i, count - i, rv);
+}
+#endif
+
+bool versions_below(WordLock* const* locks, size_t count, uint64_t rv) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (likely(has_avx2))
+        return versions_below_avx2(locks, count, rv);
+#endif
+    return versions_below_scalar(locks, count, rv);
+}
+
+// -------------------------------------------------------------------------- //
+// Helper pool
+
+ValidatePool::ValidatePool(size_t nbhelpers) {
+    this->generation = 0;
+    this->stopping = false;
+    this->job_locks = nullptr;
+    this->job_count = 0;
+    this->job_rv = 0;
+    this->job_busy = 0;
+    this->next.store(0);
+    this->failed.store(false);
+    this->jobs = 0;
+    for (size_t i = 0; i < nbhelpers; ++i)
+        this->helpers.emplace_back(&ValidatePool::run, this);
+}
+
+ValidatePool::~ValidatePool() {
+    {
+        lock_guard<mutex> lock(this->lock_wake);
+        this->stopping = true;
+    }
+    this->cv_wake.notify_all();
+    for (auto& helper: this->helpers)
+        helper.join();
+}
+
+/** Claim chunks of the current job until there are none left or a version check failed.
+**/
+void ValidatePool::work() {
+    while (likely(!this->failed.load(memory_order_relaxed))) {
+        size_t start = this->next.fetch_add(helper_chunk);
+        if (start >= this->job_count)
+            return;
+        if (!versions_below(this->job_locks + start, min(helper_chunk, this->job_count - start), this->job_rv))
+            this->failed.store(true);
+    }
+}
+
+void ValidatePool::run() {
+    uint64_t seen = 0;
+    unique_lock<mutex> lock(this->lock_wake);
+    while (true) {
+        this->cv_wake.wait(lock, [&] { return this->stopping || this->generation != seen; });
+        if (this->stopping)
+            return;
+        seen = this->generation;
+        lock.unlock();
+        this->work();
+        lock.lock();
+        if (--this->job_busy == 0)
+            this->cv_done.notify_one();
+    }
+}
+
+/** Whether no version of the given word locks exceeds a read version, splitting large arrays across the helpers.
+ * A committer finding the pool busy with another read set validates alone.
+ * @param locks Word locks to check, must stay valid until the call returns
+ * @param count Number of word locks
+ * @param rv    Read version
+ * @return Whether every version is at most 'rv'
+**/
+bool ValidatePool::validate(WordLock* const* locks, size_t count, uint64_t rv) {
+    if (count < helper_reads || !this->lock_job.try_lock())
+        return versions_below(locks, count, rv);
+    {
+        lock_guard<mutex> lock(this->lock_wake);
+        this->job_locks = locks;
+        this->job_count = count;
+        this->job_rv = rv;
+        this->job_busy = this->helpers.size();
+        this->next.store(0);
+        this->failed.store(false);
+        ++this->generation;
+        ++this->jobs;
+    }
+    this->cv_wake.notify_all();
+    this->work();
+    {
+        unique_lock<mutex> lock(this->lock_wake);
+        this->cv_done.wait(lock, [&] { return this->job_busy == 0; });
+    }
+    bool valid = !this->failed.load();
+    this->lock_job.unlock();
+    return valid;
+}
+
+ValidatePool* validate_pool_from_env() {
+    const char* helpers = getenv("TM_VALIDATE_HELPERS");
+    if (helpers == nullptr)
+        return nullptr;
+    size_t nbhelpers = strtoul(helpers, nullptr, 10);
+    if (nbhelpers == 0)
+        return nullptr;
+    return new ValidatePool(nbhelpers);
+}
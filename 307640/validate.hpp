@@ -0,0 +1,60 @@
+#pragma once
+
+// External headers
+#include <condition_variable>
+#include <thread>
+
+// Internal headers
+#include "help.hpp"
+
+// -------------------------------------------------------------------------- //
+// Bulk read-set validation: version checks over a flat array of word locks, vectorized with AVX2
+// gathers when the CPU supports them, and optionally split across a small helper pool.
+// Enabled (the pool) by setting TM_VALIDATE_HELPERS to the number of helper threads.
+
+/** Read sets below this size are validated by the committing thread alone.
+**/
+constexpr static size_t helper_reads = 16384;
+
+/** Number of word locks a participant (committer or helper) claims at once.
+**/
+constexpr static size_t helper_chunk = 4096;
+
+/** Whether no version of the given word locks exceeds a read version.
+ * @param locks Word locks to check
+ * @param count Number of word locks
+ * @param rv    Read version
+ * @return Whether every version is at most 'rv'
+**/
+bool versions_below(WordLock* const* locks, size_t count, uint64_t rv);
+
+class ValidatePool {
+public:
+    vector<thread> helpers;
+    mutex lock_job;           // Held by the committer whose read set is being validated
+    mutex lock_wake;
+    condition_variable cv_wake;
+    condition_variable cv_done;
+    uint64_t generation;      // Bumped for every job
+    bool stopping;
+    WordLock* const* job_locks;
+    size_t job_count;
+    uint64_t job_rv;
+    size_t job_busy;          // Helpers still working on the current job
+    atomic<size_t> next;      // Next word lock to claim in the current job
+    atomic_bool failed;
+    uint64_t jobs;
+    ValidatePool(size_t nbhelpers);
+    ~ValidatePool();
+    ValidatePool(const ValidatePool&) = delete;
+    ValidatePool& operator=(const ValidatePool&) = delete;
+    bool validate(WordLock* const* locks, size_t count, uint64_t rv);
+private:
+    void run();
+    void work();
+};
+
+/** Read the validation pool configuration from the environment.
+ * @return Validation pool instance, 'nullptr' if disabled
+**/
+ValidatePool* validate_pool_from_env();
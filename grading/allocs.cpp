@@ -0,0 +1,130 @@
+/**
+ * @file   allocs.cpp
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version. Please see https://gnu.org/licenses/gpl.html
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Allocator wrappers: being defined in the executable, they take precedence over the C library for every loaded
+ * library (including the TM libraries and the C++ runtime, hence 'new'/'make_shared'), and forward to glibc's
+ * internal entry points, which never call back into them.
+**/
+
+// External headers
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+// Internal headers
+#include "allocs.hpp"
+
+// -------------------------------------------------------------------------- //
+
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+void  __libc_free(void*);
+}
+
+namespace {
+
+/** Whether the wrappers count.
+**/
+::std::atomic<bool> counting{false};
+
+/** Running counts of the calling thread (plain thread-local storage of the executable: no allocation on first use).
+**/
+thread_local uint_fast64_t counts[AllocCounters::nbevents];
+
+/** Count an allocation.
+ * @param ptr  Allocated block, 'nullptr' on failure
+ * @param size Requested size (in bytes)
+**/
+inline void count_alloc(void* ptr, size_t size) noexcept {
+    if (!counting.load(::std::memory_order_relaxed) || !ptr)
+        return;
+    ++counts[AllocCounters::allocations];
+    counts[AllocCounters::bytes] += size;
+}
+
+/** Count a free.
+ * @param ptr Freed block
+**/
+inline void count_free(void* ptr) noexcept {
+    if (!counting.load(::std::memory_order_relaxed) || !ptr)
+        return;
+    ++counts[AllocCounters::frees];
+}
+
+}
+
+void AllocCounters::enable() noexcept {
+    counting.store(true, ::std::memory_order_relaxed);
+}
+
+uint_fast64_t const* AllocCounters::current() noexcept {
+    return counts;
+}
+
+// -------------------------------------------------------------------------- //
+
+extern "C" {
+
+void* malloc(size_t size) {
+    auto res = __libc_malloc(size);
+    count_alloc(res, size);
+    return res;
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    auto res = __libc_calloc(nmemb, size);
+    count_alloc(res, nmemb * size);
+    return res;
+}
+
+void* realloc(void* ptr, size_t size) {
+    auto res = __libc_realloc(ptr, size);
+    if (res || size == 0) // A failed reallocation leaves the block untouched
+        count_free(ptr);
+    count_alloc(res, size);
+    return res;
+}
+
+void free(void* ptr) {
+    count_free(ptr);
+    __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    auto res = __libc_memalign(alignment, size);
+    count_alloc(res, size);
+    return res;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    auto res = memalign(alignment, size);
+    if (!res && size != 0)
+        return ENOMEM;
+    *memptr = res;
+    return 0;
+}
+
+}
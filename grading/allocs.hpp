@@ -0,0 +1,80 @@
+/**
+ * @file   allocs.hpp
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version. Please see https://gnu.org/licenses/gpl.html
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Heap call counters, fed by the allocator wrappers linked into the grading executable (see 'allocs.cpp').
+**/
+
+#pragma once
+
+// External headers
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// -------------------------------------------------------------------------- //
+
+/** Heap call counters of the calling thread, counting only while enabled.
+**/
+class AllocCounters final {
+public:
+    /** Counted events.
+    **/
+    enum Event: size_t {
+        allocations,
+        frees,
+        bytes,
+        nbevents
+    };
+    /** Per-event totals, accumulated by every thread.
+    **/
+    class Totals final {
+    public:
+        ::std::atomic<uint_fast64_t> values[nbevents];
+        /** Zero constructor.
+        **/
+        Totals() {
+            for (size_t i = 0; i < nbevents; ++i)
+                values[i].store(0, ::std::memory_order_relaxed);
+        }
+    };
+    constexpr static char const* names[nbevents] = {"allocations", "frees", "bytes allocated"};
+    /** Make the allocator wrappers count, for every thread (they only forward otherwise).
+    **/
+    static void enable() noexcept;
+    /** Get the running counts of the calling thread.
+     * @return Array of 'nbevents' counts
+    **/
+    static uint_fast64_t const* current() noexcept;
+private:
+    uint_fast64_t snapshot[nbevents]; // Counts at the last 'start'
+public:
+    /** Start counting (snapshot the running counts).
+    **/
+    void start() noexcept {
+        auto counts = current();
+        for (size_t i = 0; i < nbevents; ++i)
+            snapshot[i] = counts[i];
+    }
+    /** Stop counting, and add the counts since the last 'start' to the totals.
+     * @param totals Totals to add to
+    **/
+    void stop(Totals& totals) noexcept {
+        auto counts = current();
+        for (size_t i = 0; i < nbevents; ++i)
+            totals.values[i].fetch_add(counts[i] - snapshot[i], ::std::memory_order_relaxed);
+    }
+};
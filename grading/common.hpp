@@ -24,17 +24,29 @@
 #pragma once
 
 // External headers
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <exception>
+#include <fstream>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <utility>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 extern "C" {
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
 }
 
 // -------------------------------------------------------------------------- //
@@ -141,7 +153,15 @@ public:
     **/
     using Tick = uint_fast64_t;
     constexpr static auto invalid_tick = Tick{0xbadc0de}; // Invalid tick value
+    /** Time source class.
+    **/
+    enum class Source {
+        monotonic, // 'clock_gettime(CLOCK_MONOTONIC)'
+        tsc        // Time-stamp counter, calibrated against the monotonic clock
+    };
 private:
+    inline static Source source = Source::monotonic; // Time source of every instance
+    inline static double tsc_per_ns = 0.;            // Calibrated TSC frequency (in GHz)
     Tick total; // Total tick counter
     Tick local; // Segment tick counter
 public:
@@ -163,23 +183,83 @@ private:
             return invalid_tick + 1;
         return res;
     }
+    /** Read the current time from the time source.
+     * @return Current time
+    **/
+    static Tick now() noexcept {
+#if defined(__i386__) || defined(__x86_64__)
+        if (source == Source::tsc) {
+            auto res = static_cast<Tick>(static_cast<double>(__rdtsc()) / tsc_per_ns);
+            if (unlikely(res == invalid_tick)) // Bad luck...
+                return invalid_tick + 1;
+            return res;
+        }
+#endif
+        return convert(::clock_gettime);
+    }
 public:
+    /** Switch every instance to the time-stamp counter, if invariant, after calibrating it.
+     * @return Whether the time-stamp counter is now the time source
+    **/
+    static bool use_tsc() {
+#if defined(__i386__) || defined(__x86_64__)
+        { // Only an invariant TSC (constant rate, ticking in deep C-states) measures time
+            ::std::ifstream cpuinfo{"/proc/cpuinfo"};
+            ::std::string line;
+            bool constant = false;
+            bool nonstop = false;
+            while (::std::getline(cpuinfo, line) && !(constant && nonstop)) {
+                if (line.compare(0, 5, "flags") != 0)
+                    continue;
+                constant = line.find(" constant_tsc") != ::std::string::npos;
+                nonstop = line.find(" nonstop_tsc") != ::std::string::npos;
+            }
+            if (!constant || !nonstop)
+                return false;
+        }
+        double rates[5];
+        for (auto& rate: rates) { // Keep the median of a few 20 ms calibrations
+            auto time_start = convert(::clock_gettime);
+            auto tsc_start = __rdtsc();
+            ::std::this_thread::sleep_for(::std::chrono::milliseconds{20});
+            auto time_stop = convert(::clock_gettime);
+            auto tsc_stop = __rdtsc();
+            rate = static_cast<double>(tsc_stop - tsc_start) / static_cast<double>(time_stop - time_start);
+        }
+        ::std::sort(rates, rates + 5);
+        if (!(rates[2] > 0.))
+            return false;
+        tsc_per_ns = rates[2];
+        source = Source::tsc;
+        return true;
+#else
+        return false;
+#endif
+    }
+    /** Get the calibrated frequency of the time-stamp counter.
+     * @return Frequency (in GHz), 0 if not the time source
+    **/
+    static auto get_tsc_frequency() noexcept {
+        return source == Source::tsc ? tsc_per_ns : 0.;
+    }
     /** Get the resolution of the clock used.
      * @return Resolution (in ns), 'invalid_tick' for unknown
     **/
     static auto get_resolution() noexcept {
+        if (source == Source::tsc)
+            return Tick{1}; // Sub-nanosecond, rounded to the tick
         return convert(::clock_getres);
     }
 public:
     /** Start measuring a time segment.
     **/
     void start() noexcept {
-        local = convert(::clock_gettime);
+        local = now();
     }
     /** Measure a time segment.
     **/
     auto delta() noexcept {
-        return convert(::clock_gettime) - local;
+        return now() - local;
     }
     /** Stop measuring a time segment, and add it to the total.
     **/
@@ -199,6 +279,234 @@ public:
     }
 };
 
+/** Performance counters of the calling thread: user-space hardware events from Linux 'perf_event_open', scaled up
+ * when the kernel multiplexed them, and context switches from 'getrusage' (which needs no perf permission).
+**/
+class PerfCounters final {
+public:
+    /** Counted events.
+    **/
+    enum Event: size_t {
+        cycles,
+        instructions,
+        l1d_misses,
+        llc_misses,
+        branch_misses,
+        context_switches,
+        nbevents
+    };
+    /** Per-event totals, accumulated by every thread.
+    **/
+    class Totals final {
+    public:
+        ::std::atomic<uint_fast64_t> values[nbevents];
+        ::std::atomic<bool>       available[nbevents]; // Whether every thread could count the event
+        /** Zero constructor.
+        **/
+        Totals() {
+            for (size_t i = 0; i < nbevents; ++i) {
+                values[i].store(0, ::std::memory_order_relaxed);
+                available[i].store(true, ::std::memory_order_relaxed);
+            }
+        }
+    };
+    constexpr static char const* names[nbevents] = {"cycles", "instructions", "L1D misses", "LLC misses", "branch misses", "context switches"};
+private:
+    /** Value of a counter opened with 'PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING'.
+    **/
+    struct Reading {
+        uint64_t count;
+        uint64_t enabled; // Time the event was enabled (in ns)
+        uint64_t running; // Time the event was actually counted (in ns), less than 'enabled' when multiplexed
+    };
+    int     fds[nbevents];   // Counter file descriptors, -1 for unavailable (always for context switches)
+    Reading bases[nbevents]; // Times at 'start', as resetting a counter does not reset them
+    long    switches;        // Context switches at 'start'
+    /** Get the context switches of the calling thread so far.
+     * @return Voluntary and involuntary context switches, -1 if unavailable
+    **/
+    static long thread_switches() noexcept {
+        struct ::rusage usage;
+        if (unlikely(::getrusage(RUSAGE_THREAD, &usage) != 0))
+            return -1;
+        return usage.ru_nvcsw + usage.ru_nivcsw;
+    }
+public:
+    /** Deleted copy constructor/assignment.
+    **/
+    PerfCounters(PerfCounters const&) = delete;
+    PerfCounters& operator=(PerfCounters const&) = delete;
+    /** Open (disabled) counters for the calling thread.
+    **/
+    PerfCounters() noexcept {
+        constexpr static ::std::pair<uint32_t, uint64_t> configs[nbevents] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}
+        };
+        for (size_t i = 0; i < nbevents; ++i) {
+            fds[i] = -1;
+            bases[i] = Reading{0, 0, 0};
+            if (i == context_switches)
+                continue;
+            struct ::perf_event_attr attr;
+            ::std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = configs[i].first;
+            attr.config = configs[i].second;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1; // Allowed up to 'perf_event_paranoid' 2
+            attr.exclude_hv = 1;
+            fds[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+        switches = -1;
+    }
+    /** Close the counters.
+    **/
+    ~PerfCounters() {
+        for (auto fd: fds) {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+public:
+    /** Reset and start counting.
+    **/
+    void start() noexcept {
+        for (size_t i = 0; i < nbevents; ++i) {
+            if (fds[i] >= 0) {
+                ::ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                if (unlikely(::read(fds[i], &bases[i], sizeof(Reading)) != sizeof(Reading)))
+                    bases[i] = Reading{0, 0, 0};
+                ::ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        switches = thread_switches();
+    }
+    /** Stop counting, and add the counts to the totals.
+     * @param totals Totals to add to
+    **/
+    void stop(Totals& totals) noexcept {
+        auto const now = thread_switches();
+        if (switches >= 0 && now >= switches)
+            totals.values[context_switches].fetch_add(static_cast<uint_fast64_t>(now - switches), ::std::memory_order_relaxed);
+        else
+            totals.available[context_switches].store(false, ::std::memory_order_relaxed);
+        for (size_t i = 0; i < nbevents; ++i) {
+            if (i == context_switches)
+                continue;
+            Reading reading;
+            if (fds[i] < 0 || ::ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0) < 0 || ::read(fds[i], &reading, sizeof(reading)) != sizeof(reading)) {
+                totals.available[i].store(false, ::std::memory_order_relaxed);
+                continue;
+            }
+            auto const enabled = reading.enabled - bases[i].enabled;
+            auto const running = reading.running - bases[i].running;
+            if (unlikely(running == 0)) { // Never scheduled on the PMU, nothing to extrapolate from
+                if (enabled > 0)
+                    totals.available[i].store(false, ::std::memory_order_relaxed);
+                continue;
+            }
+            auto const scaled = running < enabled ? static_cast<double>(reading.count) * static_cast<double>(enabled) / static_cast<double>(running) : static_cast<double>(reading.count);
+            totals.values[i].fetch_add(static_cast<uint_fast64_t>(scaled), ::std::memory_order_relaxed);
+        }
+    }
+};
+
+/** Memory usage of the whole process.
+**/
+class MemoryUsage final {
+public:
+    size_t rss;  // Resident set size (in bytes)
+    size_t anon; // Resident anonymous memory (in bytes)
+public:
+    /** Sample the current usage, from '/proc/self/smaps_rollup' (or '/proc/self/statm' if unavailable).
+     * @return Current usage, zero if unavailable
+    **/
+    static MemoryUsage sample() {
+        MemoryUsage res{0, 0};
+        ::std::ifstream rollup{"/proc/self/smaps_rollup"};
+        if (likely(rollup)) {
+            for (::std::string line; ::std::getline(rollup, line);) { // Values in kB
+                if (line.compare(0, 4, "Rss:") == 0) {
+                    res.rss = ::std::stoul(line.substr(4)) * 1024;
+                } else if (line.compare(0, 10, "Anonymous:") == 0) {
+                    res.anon = ::std::stoul(line.substr(10)) * 1024;
+                }
+            }
+            return res;
+        }
+        ::std::ifstream statm{"/proc/self/statm"}; // Values in pages
+        size_t size, resident, shared;
+        if (statm >> size >> resident >> shared) {
+            auto const page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            res.rss  = resident * page;
+            res.anon = (resident - shared) * page;
+        }
+        return res;
+    }
+};
+
+/** Background sampler of the peak memory usage of the process.
+**/
+class MemorySampler final {
+private:
+    ::std::atomic<bool>   running; // Whether the sampler must keep sampling
+    ::std::atomic<size_t> peak;    // Peak resident set size since the last reset (in bytes)
+    ::std::mutex          lock;    // Guards 'waker'
+    ::std::condition_variable waker; // To stop without waiting a full period
+    ::std::thread         thread;
+public:
+    /** Deleted copy constructor/assignment.
+    **/
+    MemorySampler(MemorySampler const&) = delete;
+    MemorySampler& operator=(MemorySampler const&) = delete;
+    /** Start sampling.
+     * @param period Sampling period
+    **/
+    MemorySampler(::std::chrono::milliseconds period): running{true}, peak{MemoryUsage::sample().rss} {
+        thread = ::std::thread{[this, period]() {
+            ::std::unique_lock<decltype(lock)> guard{lock};
+            while (running.load(::std::memory_order_relaxed)) {
+                guard.unlock();
+                update(MemoryUsage::sample().rss);
+                guard.lock();
+                waker.wait_for(guard, period);
+            }
+        }};
+    }
+    /** Stop sampling.
+    **/
+    ~MemorySampler() {
+        {
+            ::std::unique_lock<decltype(lock)> guard{lock};
+            running.store(false, ::std::memory_order_relaxed);
+        }
+        waker.notify_all();
+        thread.join();
+    }
+private:
+    /** Account for one sample.
+     * @param rss Sampled resident set size (in bytes)
+    **/
+    void update(size_t rss) noexcept {
+        auto cur = peak.load(::std::memory_order_relaxed);
+        while (rss > cur && !peak.compare_exchange_weak(cur, rss, ::std::memory_order_relaxed));
+    }
+public:
+    /** Get the peak since the last reset (or construction), and reset it to the current usage.
+     * @return Peak resident set size (in bytes)
+    **/
+    size_t reset() {
+        auto rss = MemoryUsage::sample().rss;
+        update(rss); // The end of a phase counts in it
+        return peak.exchange(rss, ::std::memory_order_relaxed);
+    }
+};
+
 /** Atomic waitable latch class.
 **/
 class Latch final {
@@ -264,15 +572,20 @@ static void short_pause() {
 
 /** Run some function for some bounded time, throws 'Exception::BoundedOverrun' on overtime.
  * @param dur  Maximum execution duration
- * @param func Function to run (void -> void)
+ * @param func Function to run (void -> void), its exception (if any) is rethrown in the caller
  * @param emsg Null-terminated error message
 **/
 template<class Rep, class Period, class Func> static void bounded_run(::std::chrono::duration<Rep, Period> const& dur, Func&& func, char const* emsg) {
     ::std::mutex lock;
     ::std::unique_lock<decltype(lock)> guard{lock};
     ::std::condition_variable cv;
+    ::std::exception_ptr error;
     ::std::thread runner{[&]() {
-        func();
+        try {
+            func();
+        } catch (...) {
+            error = ::std::current_exception();
+        }
         { // Notify master
             ::std::unique_lock<decltype(lock)> guard{lock};
             cv.notify_all();
@@ -283,6 +596,8 @@ template<class Rep, class Period, class Func> static void bounded_run(::std::chr
         throw Exception::BoundedOverrun{emsg};
     }
     runner.join();
+    if (unlikely(error))
+        ::std::rethrow_exception(error);
 }
 
 /** Spin barrier class.
@@ -24,13 +24,23 @@
 // External headers
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <optional>
 #include <random>
+#include <sstream>
+#include <string>
 #include <variant>
+#include <vector>
 
 // Internal headers
+#include "allocs.hpp"
 #include "common.hpp"
+#include "replay.hpp"
+#include "results.hpp"
 #include "transactional.hpp"
 #include "workload.hpp"
 
@@ -55,6 +65,7 @@ private:
     ::std::atomic<unsigned int> nbready; // Number of thread having reached that state
     ::std::atomic<Status>       status;  // Current synchronization status
     ::std::atomic<char const*>  errmsg;  // Any one of the error message(s)
+    ::std::atomic<unsigned int> round;   // Tag of the current run, set by the master
     Chrono                      runtime; // Runtime between 'master_notify' and when the last worker finished
     Latch                     donelatch; // For synchronization last worker -> master
 public:
@@ -65,12 +76,14 @@ public:
     /** Worker count constructor.
      * @param nbworkers Number of workers to support
     **/
-    Sync(unsigned int nbworkers): nbworkers{nbworkers}, nbready{0}, status{Status::Done}, errmsg{nullptr} {}
+    Sync(unsigned int nbworkers): nbworkers{nbworkers}, nbready{0}, status{Status::Done}, errmsg{nullptr}, round{0} {}
 public:
     /** Master trigger "synchronized" execution in all threads (instead of joining).
+     * @param tag Tag of the run, for the workers to tell what to run (optional)
     **/
-    void master_notify() noexcept {
-        status.store(Status::Wait, ::std::memory_order_relaxed);
+    void master_notify(unsigned int tag = 0) noexcept {
+        round.store(tag, ::std::memory_order_relaxed);
+        status.store(Status::Wait, ::std::memory_order_release); // Synchronize-with workers leaving 'worker_wait'
         runtime.start();
     }
     /** Master trigger termination in all threads (instead of notifying).
@@ -101,7 +114,7 @@ public:
     **/
     bool worker_wait() noexcept {
         while (true) {
-            auto res = status.load(::std::memory_order_relaxed);
+            auto res = status.load(::std::memory_order_acquire);
             if (res == Status::Wait)
                 break;
             if (res == Status::Quit)
@@ -136,19 +149,124 @@ public:
             donelatch.raise(); // Synchronize-with 'master_wait'
         }
     }
+    /** Get the tag of the current run, once the worker left 'worker_wait'.
+     * @return Tag passed to 'master_notify'
+    **/
+    unsigned int worker_round() const noexcept {
+        return round.load(::std::memory_order_relaxed);
+    }
+};
+
+/** Repetition policy of the performance measurements.
+**/
+class Repetitions final {
+public:
+    unsigned int warmups; // Number of discarded runs first
+    unsigned int min;     // Minimum number of measured runs
+    unsigned int max;     // Maximum number of measured runs
+    double       target;  // Relative half-width of the 95% confidence interval of the mean to reach to stop before 'max', 0 for none
+};
+
+/** Memory usage of the process along one library evaluation.
+**/
+class MemoryProfile final {
+public:
+    size_t peak[3];                   // Peak resident set size in the initialization, performance measurements and correctness check (in bytes)
+    ::std::vector<MemoryUsage> after; // Usage after each measured repetition
+};
+
+/** Two-sided 95% quantile of Student's t distribution.
+ * @param dof Degrees of freedom (positive)
+ * @return Quantile
+**/
+static double student_t95(size_t dof) {
+    constexpr static double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (dof <= sizeof(table) / sizeof(*table))
+        return table[dof - 1];
+    if (dof <= 40)
+        return 2.021;
+    if (dof <= 60)
+        return 2.000;
+    if (dof <= 120)
+        return 1.980;
+    return 1.960;
+}
+
+/** Summary statistics of the measured runs (in ns).
+**/
+class Statistics final {
+public:
+    size_t count;  // Number of measured runs
+    double median;
+    double mean;
+    double stddev; // Sample standard deviation
+    double min;
+    double max;
+    double ci95;   // Half-width of the 95% confidence interval of the mean
+    double median_lo; // Bounds of the distribution-free 95% confidence interval of the median
+    double median_hi;
+public:
+    /** Summarize samples.
+     * @param samples Samples (sorted)
+     * @return Statistics of the samples
+    **/
+    static Statistics of(::std::vector<Chrono::Tick>& samples) {
+        Statistics res{samples.size(), 0., 0., 0., 0., 0., 0., 0., 0.};
+        if (unlikely(samples.empty()))
+            return res;
+        ::std::sort(samples.begin(), samples.end());
+        auto const posmedian = samples.size() / 2; // Same median as the timeouts are based on
+        res.median = static_cast<double>(samples[posmedian]);
+        res.min = static_cast<double>(samples.front());
+        res.max = static_cast<double>(samples.back());
+        { // Order statistics around the median, from the normal approximation of the binomial(n, 1/2) rank distribution
+            auto const n    = static_cast<double>(res.count);
+            auto const half = 1.960 * ::std::sqrt(n) / 2.;
+            auto const lo   = static_cast<size_t>(::std::max(0., ::std::ceil(n / 2. - half) - 1.));
+            auto const hi   = static_cast<size_t>(::std::min(n - 1., ::std::ceil(n / 2. + half)));
+            res.median_lo = static_cast<double>(samples[lo]);
+            res.median_hi = static_cast<double>(samples[hi]);
+        }
+        for (auto sample: samples)
+            res.mean += static_cast<double>(sample);
+        res.mean /= static_cast<double>(res.count);
+        if (res.count > 1) {
+            for (auto sample: samples)
+                res.stddev += (static_cast<double>(sample) - res.mean) * (static_cast<double>(sample) - res.mean);
+            res.stddev = ::std::sqrt(res.stddev / static_cast<double>(res.count - 1));
+            res.ci95 = student_t95(res.count - 1) * res.stddev / ::std::sqrt(static_cast<double>(res.count));
+        }
+        return res;
+    }
+    /** Relative half-width of the 95% confidence interval of the mean.
+     * @return Relative half-width, 0 if undefined
+    **/
+    double relative_ci() const noexcept {
+        return mean > 0. ? ci95 / mean : 0.;
+    }
+    /** Relative half-width of the 95% confidence interval of the median.
+     * @return Relative half-width, 0 if undefined
+    **/
+    double relative_median_ci() const noexcept {
+        return median > 0. ? (median_hi - median_lo) / 2. / median : 0.;
+    }
 };
 
 /** Measure the arithmetic mean of the execution time of the given workload with the given transaction library.
  * @param workload     Workload instance to use
  * @param nbthreads    Number of concurrent threads to use
- * @param nbrepeats    Number of repetitions (keep the median)
+ * @param repeats      Repetition policy (warm-ups are discarded, keep the median of the others)
  * @param seed         Seed to use for performance measurements
  * @param maxtick_init Timeout for (re)initialization ('Chrono::invalid_tick' for none)
  * @param maxtick_perf Timeout for performance measurements ('Chrono::invalid_tick' for none)
  * @param maxtick_chck Timeout for correctness check ('Chrono::invalid_tick' for none)
- * @return Error constant null-terminated string ('nullptr' for none), execution times (in ns) (undefined if inconsistency detected)
+ * @param perf         Performance counter totals of the measured repetitions, accumulated by every thread ('nullptr' for none)
+ * @param allocs       Heap call totals of the initialization, measured repetitions and correctness check, accumulated by every thread ('nullptr' for none)
+ * @param memory       Memory usage profile to fill ('nullptr' for none)
+ * @return Error constant null-terminated string ('nullptr' for none), execution times (in ns), statistics and times (in ns) of the measured runs (undefined if inconsistency detected)
 **/
-static auto measure(Workload& workload, unsigned int const nbthreads, unsigned int const nbrepeats, Seed seed, Chrono::Tick maxtick_init, Chrono::Tick maxtick_perf, Chrono::Tick maxtick_chck) {
+static auto measure(Workload& workload, unsigned int const nbthreads, Repetitions const& repeats, Seed seed, Chrono::Tick maxtick_init, Chrono::Tick maxtick_perf, Chrono::Tick maxtick_chck, PerfCounters::Totals* perf = nullptr, AllocCounters::Totals* allocs = nullptr, MemoryProfile* memory = nullptr) {
+    enum: unsigned int { round_init, round_perf, round_chck }; // Run tags
     ::std::vector<::std::thread> threads(nbthreads);
     ::std::mutex  cerrlock;        // To avoid interleaving writes to 'cerr' in case more than one thread throw
     Sync          sync{nbthreads}; // "As-synchronized-as-possible" starts so that threads interfere "as-much-as-possible"
@@ -156,20 +274,47 @@ static auto measure(Workload& workload, unsigned int const nbthreads, unsigned i
         try {
             threads[i] = ::std::thread{[&](unsigned int i) {
                 try {
+                    ThreadRegistration registration{workload.get_tm()}; // Per-thread context, if the library supports it
+                    ::std::optional<PerfCounters> counters;
+                    if (perf)
+                        counters.emplace();
+                    AllocCounters heap;
                     // Initialization
                     if (!sync.worker_wait())
                         return;
-                    sync.worker_notify(workload.init());
-                    // Performance measurements
-                    for (unsigned int count = 0; count < nbrepeats; ++count) {
+                    if (allocs)
+                        heap.start();
+                    auto error = workload.init();
+                    if (allocs)
+                        heap.stop(allocs[round_init]);
+                    sync.worker_notify(error);
+                    // Performance measurements (warm-ups included), as many as the master asks for
+                    for (unsigned int count = 0;; ++count) {
                         if (!sync.worker_wait())
                             return;
-                        sync.worker_notify(workload.run(i, seed + nbthreads * count + i));
+                        if (sync.worker_round() != round_perf)
+                            break;
+                        auto const counted = counters && count >= repeats.warmups;
+                        if (counted)
+                            counters->start();
+                        if (allocs && count >= repeats.warmups)
+                            heap.start();
+                        auto const run = count >= repeats.warmups ? count - repeats.warmups : repeats.max + count; // Warm-ups take the seeds after the measured runs, which keep theirs
+                        auto error = workload.run(i, seed + nbthreads * run + i);
+                        if (allocs && count >= repeats.warmups)
+                            heap.stop(allocs[round_perf]);
+                        if (counted)
+                            counters->stop(*perf);
+                        sync.worker_notify(error);
                     }
-                    // Correctness check
-                    if (!sync.worker_wait())
-                        return;
-                    sync.worker_notify(workload.check(i, std::random_device{}())); // Random seed is wanted here
+                    // Correctness check (run already started)
+                    auto const chck_seed = std::random_device{}(); // Random seed is wanted here
+                    if (allocs)
+                        heap.start();
+                    error = workload.check(i, chck_seed);
+                    if (allocs)
+                        heap.stop(allocs[round_chck]);
+                    sync.worker_notify(error);
                     // Synchronized quit
                     if (!sync.worker_wait())
                         return;
@@ -192,45 +337,63 @@ static auto measure(Workload& workload, unsigned int const nbthreads, unsigned i
     try {
         char const* error = nullptr;
         Chrono::Tick time_init = Chrono::invalid_tick;
-        Chrono::Tick times[nbrepeats];
+        ::std::vector<Chrono::Tick> times;
         Chrono::Tick time_chck = Chrono::invalid_tick;
-        auto const posmedian = nbrepeats / 2;
+        Statistics stats = Statistics::of(times);
+        ::std::optional<MemorySampler> sampler; // Peak usage sampler, perturbs the measurements a little
+        if (memory)
+            sampler.emplace(::std::chrono::milliseconds{5});
         { // Initialization (with cheap correctness test)
-            sync.master_notify();
+            sync.master_notify(round_init);
             auto res = sync.master_wait(maxtick_init);
             if (unlikely(::std::holds_alternative<char const*>(res))) {
                 error = ::std::get<char const*>(res);
                 goto join;
             }
             time_init = ::std::get<Chrono>(res).get_tick();
+            if (memory)
+                memory->peak[round_init] = sampler->reset();
         }
         { // Performance measurements (with cheap correctness tests)
-            for (unsigned int i = 0; i < nbrepeats; ++i) {
-                sync.master_notify();
+            for (unsigned int i = 0; i < repeats.warmups + repeats.max; ++i) {
+                sync.master_notify(round_perf);
                 auto res = sync.master_wait(maxtick_perf);
                 if (unlikely(::std::holds_alternative<char const*>(res))) {
                     error = ::std::get<char const*>(res);
                     goto join;
                 }
-                times[i] = ::std::get<Chrono>(res).get_tick();
+                if (i < repeats.warmups)
+                    continue;
+                times.push_back(::std::get<Chrono>(res).get_tick());
+                if (memory)
+                    memory->after.push_back(MemoryUsage::sample());
+                if (times.size() >= repeats.min) { // Stop once precise enough
+                    stats = Statistics::of(times);
+                    if (repeats.target <= 0. || stats.relative_ci() <= repeats.target)
+                        break;
+                }
             }
-            ::std::nth_element(times, times + posmedian, times + nbrepeats); // Partition times around the median
+            stats = Statistics::of(times);
+            if (memory)
+                memory->peak[round_perf] = sampler->reset();
         }
         { // Correctness check
-            sync.master_notify();
+            sync.master_notify(round_chck);
             auto res = sync.master_wait(maxtick_chck);
             if (unlikely(::std::holds_alternative<char const*>(res))) {
                 error = ::std::get<char const*>(res);
                 goto join;
             }
             time_chck = ::std::get<Chrono>(res).get_tick();
+            if (memory)
+                memory->peak[round_chck] = sampler->reset();
         }
         join: { // Joining
             sync.master_join(); // Join with threads
             for (unsigned int i = 0; i < nbthreads; ++i)
                 threads[i].join();
         }
-        return ::std::make_tuple(error, time_init, times[posmedian], time_chck);
+        return ::std::make_tuple(error, time_init, static_cast<Chrono::Tick>(stats.median), time_chck, stats, ::std::move(times));
     } catch (...) {
         for (unsigned int i = 0; i < nbthreads; ++i) // Detach threads to avoid termination due to attached thread going out of scope
             threads[i].detach();
@@ -238,6 +401,83 @@ static auto measure(Workload& workload, unsigned int const nbthreads, unsigned i
     }
 }
 
+/** Soak a bank workload: run it continuously, periodically reporting throughput and memory stability.
+ * @param bank      Bank workload to soak (initialized here)
+ * @param nbthreads Number of concurrent threads
+ * @param seed      Seed to use
+ * @param duration  Total duration of the soak
+ * @param period    Period of the reports
+ * @param wave      Period of the oscillation of the number of accounts
+ * @param low       Smallest number of accounts the oscillation goes to
+ * @param high      Largest number of accounts the oscillation goes to
+ * @return Error constant null-terminated string ('nullptr' for none)
+**/
+static char const* soak(WorkloadBank const& bank, unsigned int const nbthreads, Seed seed, ::std::chrono::seconds duration, ::std::chrono::seconds period, ::std::chrono::seconds wave, size_t low, size_t high) {
+    constexpr size_t nbtxperbatch = 256; // Transactions between two looks at the stop flag and trigger
+    ThreadRegistration registration{bank.get_tm()};
+    AllocCounters::Totals heap; // Heap calls of the initialization and of the workers (the latter gathered per batch, so approximate)
+    {
+        AllocCounters counters;
+        counters.start();
+        auto error = bank.init();
+        counters.stop(heap);
+        if (error)
+            return error;
+    }
+    ::std::atomic<bool>          running{true};
+    ::std::atomic<char const*>   error{nullptr};
+    ::std::atomic<uint_fast64_t> committed{0};
+    ::std::atomic<size_t>        trigger{low};
+    ::std::vector<::std::thread> threads;
+    for (unsigned int i = 0; i < nbthreads; ++i) {
+        threads.emplace_back([&](unsigned int i) {
+            try {
+                ThreadRegistration registration{bank.get_tm()};
+                AllocCounters counters;
+                for (auto batch_seed = seed + i; running.load(::std::memory_order_relaxed); batch_seed += nbthreads) {
+                    counters.start();
+                    auto res = bank.soak(batch_seed, nbtxperbatch, trigger.load(::std::memory_order_relaxed));
+                    counters.stop(heap);
+                    if (unlikely(res)) {
+                        error.store(res, ::std::memory_order_relaxed);
+                        break;
+                    }
+                    committed.fetch_add(nbtxperbatch, ::std::memory_order_relaxed);
+                }
+            } catch (::std::exception const& err) {
+                error.store("Internal worker exception(s)", ::std::memory_order_relaxed);
+            }
+            running.store(false, ::std::memory_order_relaxed);
+        }, i);
+    }
+    using Clock = ::std::chrono::steady_clock;
+    auto const start = Clock::now();
+    auto last_report = start;
+    auto last_committed = uint_fast64_t{0};
+    while (running.load(::std::memory_order_relaxed)) {
+        ::std::this_thread::sleep_for(::std::chrono::milliseconds{100});
+        auto const now = Clock::now();
+        auto const elapsed = ::std::chrono::duration<double>(now - start).count();
+        auto const phase = ::std::fmod(elapsed / ::std::chrono::duration<double>(wave).count(), 1.); // Triangle wave: grow, then shrink
+        trigger.store(low + static_cast<size_t>(static_cast<double>(high - low) * (phase < 0.5 ? 2. * phase : 2. - 2. * phase)), ::std::memory_order_relaxed);
+        auto const done = now - start >= duration;
+        if (now - last_report < period && !done)
+            continue;
+        auto const total = committed.load(::std::memory_order_relaxed);
+        auto const throughput = static_cast<double>(total - last_committed) / ::std::chrono::duration<double>(now - last_report).count();
+        auto const segments = bank.segments();
+        auto const live_blocks = static_cast<double>(heap.values[AllocCounters::allocations].load(::std::memory_order_relaxed)) - static_cast<double>(heap.values[AllocCounters::frees].load(::std::memory_order_relaxed));
+        ::std::cout << "⎪ [" << static_cast<uint_fast64_t>(elapsed) << " s] " << throughput << " TX/s, RSS " << (static_cast<double>(MemoryUsage::sample().rss) / 1048576.) << " MiB, " << segments << " live segments, " << live_blocks << " live heap blocks" << ::std::endl;
+        last_report = now;
+        last_committed = total;
+        if (done)
+            running.store(false, ::std::memory_order_relaxed);
+    }
+    for (auto& thread: threads)
+        thread.join();
+    return error.load(::std::memory_order_relaxed);
+}
+
 // -------------------------------------------------------------------------- //
 
 /** Program entry point.
@@ -264,79 +504,327 @@ int main(int argc, char** argv) {
         auto const nbaccounts    = 32 * nbworkers;
         auto const expnbaccounts = 256 * nbworkers;
         auto const init_balance  = 100ul;
-        auto const prob_long     = 0.5f;
-        auto const prob_alloc    = 0.01f;
-        auto const nbrepeats     = 7;
+        auto const skew          = []() { // Optional Zipfian skew of the bank accounts
+            auto env = ::std::getenv("GRADING_SKEW");
+            return env ? ::std::stof(env) : 0.f;
+        }();
+        if (unlikely(!(skew >= 0.f && skew < 1.f))) {
+            ::std::cout << "GRADING_SKEW must be in [0, 1)" << ::std::endl;
+            return 1;
+        }
+        auto const getenv_uint   = [](char const* name, unsigned int def) { // Optional unsigned knob
+            auto env = ::std::getenv(name);
+            return env ? static_cast<unsigned int>(::std::stoul(env)) : def;
+        };
+        auto const sweep_max     = static_cast<size_t>(getenv_uint("GRADING_SWEEP", 0)); // Optional data-size sweep, up to this number of accounts
+        auto const prob_long     = sweep_max > 0 ? 0.f : 0.5f;  // The sweep only runs transfers: long TXs read every account, and
+        auto const prob_alloc    = sweep_max > 0 ? 0.f : 0.01f; // allocation TXs allocate whole (data set-sized) segments
+        auto const with_perf     = ::std::getenv("GRADING_PERF") != nullptr; // Optional per-transaction performance counters
+        auto const with_allocs   = ::std::getenv("GRADING_ALLOCS") != nullptr; // Optional per-transaction heap call counters
+        auto const with_memory   = ::std::getenv("GRADING_MEMORY") != nullptr; // Optional memory footprint sampling
+        auto const soak_duration = ::std::chrono::seconds{getenv_uint("GRADING_SOAK", 0)}; // Optional soak run instead of the measurements
+        auto const soak_period   = ::std::chrono::seconds{getenv_uint("GRADING_SOAK_PERIOD", 10)};
+        auto const soak_wave     = ::std::chrono::seconds{getenv_uint("GRADING_SOAK_WAVE", 60)};
+        auto const soak_segment  = 8ul;  // Accounts per segment in soak runs, small for segments to be (de)allocated often
+        auto const soak_alloc    = 0.5f; // Allocation TX probability in soak runs
+        if (soak_duration.count() > 0)
+            AllocCounters::enable();
+        if (with_allocs)
+            AllocCounters::enable();
+        Repetitions repeats;
+        repeats.warmups = getenv_uint("GRADING_WARMUP", 1);
+        repeats.min     = getenv_uint("GRADING_REPEATS", 7);
+        repeats.max     = getenv_uint("GRADING_MAX_REPEATS", repeats.min);
+        repeats.target  = []() { // Optional relative 95% CI half-width to reach, repeating up to the maximum
+            auto env = ::std::getenv("GRADING_TARGET_CI");
+            return env ? ::std::stod(env) : 0.;
+        }();
+        if (unlikely(repeats.min == 0 || repeats.max < repeats.min)) {
+            ::std::cout << "GRADING_REPEATS must be positive and at most GRADING_MAX_REPEATS" << ::std::endl;
+            return 1;
+        }
+        auto const with_tsc      = []() { // Optional TSC-based clock, if invariant
+            auto env = ::std::getenv("GRADING_CLOCK");
+            return env && ::std::string{env} == "tsc" && Chrono::use_tsc();
+        }();
         auto const seed          = static_cast<Seed>(::std::stoul(argv[1]));
+        auto const results_path  = ::std::getenv("GRADING_RESULTS");  // Optional CSV history to append the measured runs to
+        auto const baseline      = ::std::getenv("GRADING_BASELINE"); // Optional revision in the history to compare against
+        auto const alpha         = 0.05; // Significance level of the regression test
+        if (unlikely(baseline && !results_path)) {
+            ::std::cout << "GRADING_BASELINE requires GRADING_RESULTS" << ::std::endl;
+            return 1;
+        }
+        if (unlikely(sweep_max > 0 && sweep_max < nbaccounts)) {
+            ::std::cout << "GRADING_SWEEP must be at least " << nbaccounts << " (the initial number of accounts)" << ::std::endl;
+            return 1;
+        }
+        auto const record_path   = ::std::getenv("GRADING_RECORD"); // Optional trace of every call made to the first library
+        auto const replay_path   = ::std::getenv("GRADING_REPLAY"); // Optional trace to replay instead of the measurements
+        auto const replay_timed  = []() { // Whether to replay with the recorded timing (instead of at full speed)
+            auto env = ::std::getenv("GRADING_REPLAY_TIMING");
+            return env && ::std::string{env} == "original";
+        }();
         auto const clk_res       = Chrono::get_resolution();
         auto const slow_factor   = 8ul;
+        if (replay_path) { // Same operation stream on every library, no workload nor correctness check
+            Trace trace{replay_path};
+            ::std::cout << "⎧ Replayed trace:      " << replay_path << ::std::endl;
+            ::std::cout << "⎪ #threads:            " << trace.threads.size() << ::std::endl;
+            ::std::cout << "⎪ #calls:              " << trace.nbrecords() << ::std::endl;
+            ::std::cout << "⎪ #segments:           " << trace.nbsegments << ::std::endl;
+            ::std::cout << "⎪ Region:              " << trace.header.size << " B, aligned on " << trace.header.align << " B" << ::std::endl;
+            ::std::cout << "⎩ Timing:              " << (replay_timed ? "original" : "full speed") << ::std::endl;
+            double reference = 0.;
+            for (auto i = 2; i < argc; ++i) {
+                ::std::cout << "⎧ Replaying on '" << argv[i] << "'" << (i == 2 ? " (reference)" : "") << "..." << ::std::endl;
+                TransactionalLibrary tl{argv[i]};
+                try {
+                    auto res = trace.replay(tl, replay_timed);
+                    auto const time = static_cast<double>(res.time);
+                    ::std::cout << "⎪ " << res.calls << " calls, " << res.commits << " commits, " << res.aborts << " aborts retried, " << res.divergences << " divergent attempts, " << res.skipped << " calls skipped" << ::std::endl;
+                    ::std::cout << "⎩ Replay time: " << (time / 1000000.) << " ms";
+                    if (i == 2) {
+                        reference = time;
+                    } else {
+                        ::std::cout << " -> " << (reference / time) << " speedup";
+                    }
+                    ::std::cout << ::std::endl;
+                } catch (::std::exception const& err) { // Special case: cannot unload library with running threads, so print error and quick-exit
+                    ::std::cerr << "⎪ *** EXCEPTION ***" << ::std::endl;
+                    ::std::cerr << "⎩ " << err.what() << ::std::endl;
+                    ::std::quick_exit(2);
+                }
+            }
+            return 0;
+        }
         // Print run parameters
         ::std::cout << "⎧ #worker threads:     " << nbworkers << ::std::endl;
         ::std::cout << "⎪ #TX per worker:      " << nbtxperwrk << ::std::endl;
-        ::std::cout << "⎪ #repetitions:        " << nbrepeats << ::std::endl;
+        ::std::cout << "⎪ #repetitions:        " << repeats.min;
+        if (repeats.max > repeats.min)
+            ::std::cout << " to " << repeats.max << " (target 95% CI: ±" << (repeats.target * 100.) << "%)";
+        ::std::cout << " + " << repeats.warmups << " warm-up" << ::std::endl;
         ::std::cout << "⎪ Initial #accounts:   " << nbaccounts << ::std::endl;
         ::std::cout << "⎪ Expected #accounts:  " << expnbaccounts << ::std::endl;
         ::std::cout << "⎪ Initial balance:     " << init_balance << ::std::endl;
         ::std::cout << "⎪ Long TX probability: " << prob_long << ::std::endl;
         ::std::cout << "⎪ Allocation TX prob.: " << prob_alloc << ::std::endl;
-        ::std::cout << "⎪ Slow trigger factor: " << slow_factor << ::std::endl;
+        if (skew > 0.f)
+            ::std::cout << "⎪ Zipfian skew:        " << skew << ::std::endl;
+        if (with_perf)
+            ::std::cout << "⎪ Perf counters:       on" << ::std::endl;
+        if (with_allocs)
+            ::std::cout << "⎪ Heap call counters:  on" << ::std::endl;
+        if (with_memory)
+            ::std::cout << "⎪ Memory sampling:     on" << ::std::endl;
+        if (soak_duration.count() > 0)
+            ::std::cout << "⎪ Soak:                " << soak_duration.count() << " s, report every " << soak_period.count() << " s, " << soak_segment << " to " << expnbaccounts << " accounts every " << soak_wave.count() << " s" << ::std::endl;
+        if (sweep_max == 0)
+            ::std::cout << "⎪ Slow trigger factor: " << slow_factor << ::std::endl;
+        ::std::cout << "⎪ Clock source:        ";
+        if (with_tsc) {
+            ::std::cout << "TSC (" << Chrono::get_tsc_frequency() << " GHz)" << ::std::endl;
+        } else {
+            ::std::cout << "CLOCK_MONOTONIC" << ::std::endl;
+        }
         ::std::cout << "⎪ Clock resolution:    ";
         if (unlikely(clk_res == Chrono::invalid_tick)) {
             ::std::cout << "<unknown>" << ::std::endl;
         } else {
             ::std::cout << clk_res << " ns" << ::std::endl;
         }
+        ::std::vector<::std::pair<size_t, size_t>> datasets{{nbaccounts, expnbaccounts}}; // Initial (and per segment) and expected number of accounts
+        if (sweep_max > 0 && soak_duration.count() == 0) { // Geometric sweep, each data set in one segment that the allocation TXs barely change
+            datasets.clear();
+            for (auto accounts = static_cast<size_t>(nbaccounts); accounts <= sweep_max; accounts *= 4)
+                datasets.emplace_back(accounts, accounts);
+            ::std::cout << "⎪ Data-size sweep:     " << nbaccounts << " to " << datasets.back().first << " accounts (x4 per step)" << ::std::endl;
+        }
+        if (record_path)
+            ::std::cout << "⎪ Trace recorded to:   " << record_path << " ('" << argv[2] << "', first data set; no timeouts nor speedups, as recording serializes its calls)" << ::std::endl;
         ::std::cout << "⎩ Seed value:          " << seed << ::std::endl;
-        // Library evaluations
-        double reference = 0.; // Set to avoid irrelevant '-Wmaybe-uninitialized'
+        ::std::optional<TraceRecorder> recorder; // Armed for the first transactional memory, i.e. the first library's workload
+        if (record_path)
+            recorder.emplace(record_path);
+        ::std::optional<ResultsStore> results;
+        if (results_path) {
+            results.emplace(results_path, ::std::string{}); // Configuration set per data set
+            ::std::cout << "⎧ Results history:     " << results_path << ::std::endl;
+            ::std::cout << "⎪ Revision:            " << results->revision << ::std::endl;
+            if (baseline)
+                ::std::cout << "⎪ Baseline revision:   " << baseline << ::std::endl;
+            ::std::cout << "⎩ Machine:             " << results->machine << ::std::endl;
+        }
+        auto regressed = false;
         auto const pertxdiv = static_cast<double>(nbworkers) * static_cast<double>(nbtxperwrk);
-        auto maxtick_init = Chrono::invalid_tick;
-        auto maxtick_perf = Chrono::invalid_tick;
-        auto maxtick_chck = Chrono::invalid_tick;
-        for (auto i = 2; i < argc; ++i) {
-            ::std::cout << "⎧ Evaluating '" << argv[i] << "'" << (maxtick_init == Chrono::invalid_tick ? " (reference)" : "") << "..." << ::std::endl;
-            // Load TM library
-            TransactionalLibrary tl{argv[i]};
-            // Initialize workload (shared memory lifetime bound to workload: created and destroyed at the same time)
-            WorkloadBank bank{tl, nbworkers, nbtxperwrk, nbaccounts, expnbaccounts, init_balance, prob_long, prob_alloc};
-            try {
-                // Actual performance measurements and correctness check
-                auto res = measure(bank, nbworkers, nbrepeats, seed, maxtick_init, maxtick_perf, maxtick_chck);
-                // Check false negative-free correctness
-                auto error = ::std::get<0>(res);
-                if (unlikely(error)) {
-                    ::std::cout << "⎩ " << error << ::std::endl;
-                    return 1;
+        ::std::vector<::std::vector<double>> sweep_times(argc - 2); // Median run time per library and data set (in ns)
+        for (auto const& dataset: datasets) {
+            auto const accounts    = dataset.first;
+            auto const expaccounts = dataset.second;
+            if (sweep_max > 0) {
+                ::std::cout << "⎧ Data set:            " << accounts << " accounts" << ::std::endl;
+                ::std::cout << "⎩ Working set:         " << (static_cast<double>(WorkloadBank::segment_size(accounts)) / 1048576.) << " MiB" << ::std::endl;
+            }
+            if (results) {
+                ::std::ostringstream config;
+                config << "workers=" << nbworkers << ";tx=" << nbtxperwrk << ";accounts=" << accounts << ";expaccounts=" << expaccounts << ";balance=" << init_balance << ";long=" << prob_long << ";alloc=" << prob_alloc << ";skew=" << skew;
+                results->config = config.str();
+            }
+            // Library evaluations
+            double reference = 0.; // Set to avoid irrelevant '-Wmaybe-uninitialized'
+            double reference_rci = 0.;
+            auto maxtick_init = Chrono::invalid_tick;
+            auto maxtick_perf = Chrono::invalid_tick;
+            auto maxtick_chck = Chrono::invalid_tick;
+            for (auto i = 2; i < argc; ++i) {
+                ::std::cout << "⎧ Evaluating '" << argv[i] << "'" << (i == 2 && soak_duration.count() == 0 ? " (reference)" : "") << "..." << ::std::endl;
+                auto const mem_base = with_memory ? MemoryUsage::sample() : MemoryUsage{0, 0}; // Before anything of the library is loaded
+                // Load TM library
+                TransactionalLibrary tl{argv[i]};
+                if (soak_duration.count() > 0) { // Soak instead of measuring
+                    WorkloadBank bank{tl, nbworkers, 0, soak_segment, expnbaccounts, init_balance, prob_long, soak_alloc};
+                    try {
+                        auto error = soak(bank, nbworkers, seed, soak_duration, soak_period, soak_wave, soak_segment, expnbaccounts);
+                        if (unlikely(error)) {
+                            ::std::cout << "⎩ " << error << ::std::endl;
+                            return 1;
+                        }
+                        ::std::cout << "⎩ Soak done" << ::std::endl;
+                    } catch (::std::exception const& err) {
+                        ::std::cerr << "⎪ *** EXCEPTION ***" << ::std::endl;
+                        ::std::cerr << "⎩ " << err.what() << ::std::endl;
+                        ::std::quick_exit(2);
+                    }
+                    continue;
                 }
-                // Print results
-                auto tick_init = ::std::get<1>(res);
-                auto tick_perf = ::std::get<2>(res);
-                auto tick_chck = ::std::get<3>(res);
-                auto perfdbl = static_cast<double>(tick_perf);
-                ::std::cout << "⎪ Total user execution time: " << (perfdbl / 1000000.) << " ms";
-                if (maxtick_init == Chrono::invalid_tick) { // Set reference performance
-                    maxtick_init = slow_factor * tick_init;
-                    if (unlikely(maxtick_init == Chrono::invalid_tick)) // Bad luck...
-                        ++maxtick_init;
-                    maxtick_perf = slow_factor * tick_perf;
-                    if (unlikely(maxtick_perf == Chrono::invalid_tick)) // Bad luck...
-                        ++maxtick_perf;
-                    maxtick_chck = slow_factor * tick_chck;
-                    if (unlikely(maxtick_chck == Chrono::invalid_tick)) // Bad luck...
-                        ++maxtick_chck;
-                    reference = perfdbl;
-                } else { // Compare with reference performance
-                    ::std::cout << " -> " << (reference / perfdbl) << " speedup";
+                // Initialize workload (shared memory lifetime bound to workload: created and destroyed at the same time)
+                WorkloadBank bank{tl, nbworkers, nbtxperwrk, accounts, expaccounts, init_balance, prob_long, prob_alloc, skew};
+                try {
+                    // Actual performance measurements and correctness check
+                    PerfCounters::Totals perf;
+                    AllocCounters::Totals allocs[3]; // Initialization, measured repetitions, correctness check
+                    MemoryProfile memory;
+                    auto res = measure(bank, nbworkers, repeats, seed, maxtick_init, maxtick_perf, maxtick_chck, with_perf ? &perf : nullptr, with_allocs ? allocs : nullptr, with_memory ? &memory : nullptr);
+                    // Check false negative-free correctness
+                    auto error = ::std::get<0>(res);
+                    if (unlikely(error)) {
+                        ::std::cout << "⎩ " << error << ::std::endl;
+                        return 1;
+                    }
+                    // Print results
+                    auto tick_init = ::std::get<1>(res);
+                    auto tick_perf = ::std::get<2>(res);
+                    auto tick_chck = ::std::get<3>(res);
+                    auto const& stats = ::std::get<4>(res);
+                    auto perfdbl = static_cast<double>(tick_perf);
+                    ::std::cout << "⎪ Over " << stats.count << " runs: median " << (stats.median / 1000000.) << " ms (95% CI " << (stats.median_lo / 1000000.) << "-" << (stats.median_hi / 1000000.) << " ms), mean " << (stats.mean / 1000000.) << " ± " << (stats.ci95 / 1000000.) << " ms (95% CI), stddev " << (stats.stddev / 1000000.) << " ms, min " << (stats.min / 1000000.) << " ms, max " << (stats.max / 1000000.) << " ms" << ::std::endl;
+                    ::std::cout << "⎪ Total user execution time: " << (perfdbl / 1000000.) << " ms";
+                    if (i == 2) { // Set reference performance
+                        if (sweep_max == 0 && !record_path) { // No timeout in the sweep, where falling far behind the reference is what is looked for, nor for a reference slowed down by the recording
+                            maxtick_init = slow_factor * tick_init;
+                            if (unlikely(maxtick_init == Chrono::invalid_tick)) // Bad luck...
+                                ++maxtick_init;
+                            maxtick_perf = slow_factor * tick_perf;
+                            if (unlikely(maxtick_perf == Chrono::invalid_tick)) // Bad luck...
+                                ++maxtick_perf;
+                            maxtick_chck = slow_factor * tick_chck;
+                            if (unlikely(maxtick_chck == Chrono::invalid_tick)) // Bad luck...
+                                ++maxtick_chck;
+                        }
+                        reference = perfdbl;
+                        reference_rci = stats.relative_median_ci();
+                    } else if (!record_path) { // Compare with reference performance, error propagated from the relative CIs of both medians
+                        auto const speedup = reference / perfdbl;
+                        auto const rci = stats.relative_median_ci();
+                        ::std::cout << " -> " << speedup << " ± " << (speedup * ::std::sqrt(reference_rci * reference_rci + rci * rci)) << " speedup";
+                    }
+                    ::std::cout << ::std::endl;
+                    if (with_perf) { // Counters are summed over every measured repetition, not just the median one
+                        auto const pertxrep = pertxdiv * static_cast<double>(stats.count);
+                        ::std::cout << "⎪ Per TX:";
+                        for (size_t e = 0; e < PerfCounters::nbevents; ++e) {
+                            ::std::cout << (e > 0 ? ", " : " ");
+                            if (perf.available[e].load(::std::memory_order_relaxed)) {
+                                ::std::cout << (static_cast<double>(perf.values[e].load(::std::memory_order_relaxed)) / pertxrep);
+                            } else {
+                                ::std::cout << "n/a";
+                            }
+                            ::std::cout << " " << PerfCounters::names[e];
+                        }
+                        ::std::cout << ::std::endl;
+                    }
+                    if (with_allocs) { // Heap calls of the worker threads, including the ones of the harness itself (see the reference)
+                        auto const print = [](char const* label, AllocCounters::Totals const& totals, double div) {
+                            ::std::cout << label;
+                            for (size_t e = 0; e < AllocCounters::nbevents; ++e)
+                                ::std::cout << (e > 0 ? ", " : "") << (static_cast<double>(totals.values[e].load(::std::memory_order_relaxed)) / div) << " " << AllocCounters::names[e];
+                            ::std::cout << ::std::endl;
+                        };
+                        print("⎪ Heap per TX:        ", allocs[1], pertxdiv * static_cast<double>(stats.count));
+                        print("⎪ Heap in init:       ", allocs[0], 1.);
+                        print("⎪ Heap in check:      ", allocs[2], 1.);
+                    }
+                    if (with_memory) { // Usage above the one before loading the library, including the shared data itself and the worker stacks
+                        auto const mib = [](double bytes) { return bytes / 1048576.; };
+                        auto const data = static_cast<double>(bank.data_size());
+                        auto const peak = static_cast<double>(*::std::max_element(memory.peak, memory.peak + 3));
+                        auto const base = static_cast<double>(mem_base.rss);
+                        ::std::cout << "⎪ Peak RSS:            init " << mib(static_cast<double>(memory.peak[0])) << " MiB, run " << mib(static_cast<double>(memory.peak[1])) << " MiB, check " << mib(static_cast<double>(memory.peak[2])) << " MiB (" << mib(base) << " MiB before loading)" << ::std::endl;
+                        ::std::cout << "⎪ Metadata per data B: " << ::std::max(0., (peak - base - data) / data) << " (" << mib(data) << " MiB of shared data)" << ::std::endl;
+                        if (!memory.after.empty()) {
+                            auto const& first = memory.after.front();
+                            auto const& last  = memory.after.back();
+                            auto const runs   = static_cast<double>(memory.after.size() > 1 ? memory.after.size() - 1 : 1);
+                            ::std::cout << "⎪ Growth per run:      " << (mib(static_cast<double>(last.rss) - static_cast<double>(first.rss)) / runs) << " MiB RSS, " << (mib(static_cast<double>(last.anon) - static_cast<double>(first.anon)) / runs) << " MiB anonymous" << ::std::endl;
+                        }
+                    }
+                    if (results) { // Compare with the baseline first, so that re-measuring the baseline revision is not compared with itself
+                        auto const& times = ::std::get<5>(res);
+                        ::std::vector<double> samples(times.begin(), times.end());
+                        if (baseline) {
+                            auto const previous = results->load(baseline, argv[i], "run_ns");
+                            ::std::cout << "⎪ Against baseline:    ";
+                            if (previous.empty()) {
+                                ::std::cout << "no recorded run" << ::std::endl;
+                            } else {
+                                auto test = MannWhitney::test(samples, previous);
+                                auto prevmedian = previous;
+                                ::std::nth_element(prevmedian.begin(), prevmedian.begin() + prevmedian.size() / 2, prevmedian.end());
+                                ::std::cout << (prevmedian[prevmedian.size() / 2] / 1000000.) << " ms over " << previous.size() << " runs, p = " << test.pvalue;
+                                if (test.pvalue < alpha && test.z > 0.) {
+                                    ::std::cout << " -> REGRESSION (lower throughput, higher latency)";
+                                    regressed = true;
+                                } else if (test.pvalue < alpha) {
+                                    ::std::cout << " -> improvement";
+                                } else {
+                                    ::std::cout << " -> no significant change";
+                                }
+                                ::std::cout << ::std::endl;
+                            }
+                        }
+                        if (unlikely(!results->append(argv[i], "run_ns", samples)))
+                            ::std::cout << "⎪ Unable to append to '" << results_path << "'" << ::std::endl;
+                    }
+                    ::std::cout << "⎩ Average TX execution time: " << (perfdbl / pertxdiv) << " ns" << ::std::endl;
+                    sweep_times[i - 2].push_back(perfdbl);
+                } catch (::std::exception const& err) { // Special case: cannot unload library with running threads, so print error and quick-exit
+                    ::std::cerr << "⎪ *** EXCEPTION ***" << ::std::endl;
+                    ::std::cerr << "⎩ " << err.what() << ::std::endl;
+                    ::std::quick_exit(2);
+                }
+            }
+        }
+        if (sweep_max > 0 && soak_duration.count() == 0) { // Throughput and latency against the working set, per library
+            for (auto i = 2; i < argc; ++i) {
+                ::std::cout << "⎧ Sweep of '" << argv[i] << "'" << ::std::endl;
+                for (size_t d = 0; d < datasets.size(); ++d) {
+                    auto const time = sweep_times[i - 2][d];
+                    ::std::cout << (d + 1 < datasets.size() ? "⎪ " : "⎩ ") << datasets[d].first << " accounts (" << (static_cast<double>(WorkloadBank::segment_size(datasets[d].first)) / 1048576.) << " MiB): " << (pertxdiv / time * 1000000000.) << " TX/s, " << (time / pertxdiv) << " ns per TX" << ::std::endl;
                 }
-                ::std::cout << ::std::endl;
-                ::std::cout << "⎩ Average TX execution time: " << (perfdbl / pertxdiv) << " ns" << ::std::endl;
-            } catch (::std::exception const& err) { // Special case: cannot unload library with running threads, so print error and quick-exit
-                ::std::cerr << "⎪ *** EXCEPTION ***" << ::std::endl;
-                ::std::cerr << "⎩ " << err.what() << ::std::endl;
-                ::std::quick_exit(2);
             }
         }
-        return 0;
+        return regressed ? 3 : 0;
     } catch (::std::exception const& err) {
         ::std::cerr << "⎧ *** EXCEPTION ***" << ::std::endl;
         ::std::cerr << "⎩ " << err.what() << ::std::endl;
@@ -0,0 +1,365 @@
+/**
+ * @file   replay.hpp
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version. Please see https://gnu.org/licenses/gpl.html
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Replay of a trace recorded by 'TraceRecorder' (see 'transactional.hpp') on any transactional library.
+**/
+
+#pragma once
+
+// External headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Internal headers
+#include "common.hpp"
+#include "transactional.hpp"
+
+// -------------------------------------------------------------------------- //
+
+/** Trace loaded in memory, split into per-thread transaction attempts.
+**/
+class Trace final {
+public:
+    /** One transaction attempt: a 'begin', up to the 'end' or the call that made the transaction abort.
+    **/
+    class Attempt final {
+    public:
+        size_t first;     // Index of the 'begin' record in the thread's records
+        size_t last;      // Index one past the last record of the attempt
+        bool   committed; // Whether the attempt committed when recorded
+        bool   ended;     // Whether the attempt finished with an 'end' (instead of a failed call)
+        ::std::vector<uint32_t> needs;    // Segments to be allocated (and committed) before the attempt can begin
+        ::std::vector<uint32_t> frees;    // Segments freed, to be used by no earlier attempt before the attempt can begin
+        ::std::vector<uint32_t> releases; // Segments whose freeing waits for this attempt
+    };
+    /** Outcome of one replay.
+    **/
+    class Outcome final {
+    public:
+        Chrono::Tick  time;        // Wall-clock time, from the first to the last replayed call (in ns)
+        uint_fast64_t calls;       // Replayed calls to the library
+        uint_fast64_t commits;     // Committed transactions
+        uint_fast64_t aborts;      // Aborted attempts retried because they had committed when recorded
+        uint_fast64_t divergences; // Attempts that had aborted when recorded but not when replayed
+        uint_fast64_t skipped;     // Calls skipped (addresses outside of every live segment)
+    };
+private:
+    /** Segment state during a replay.
+    **/
+    enum class State: uint8_t {
+        pending,   // Not allocated yet
+        published, // Allocated by a committed transaction
+        freed      // Freed by a committed transaction
+    };
+    /** Whether a record is a call that made its transaction abort.
+     * @param rec Record to check
+     * @return Whether the call failed
+    **/
+    static bool failed(TraceRecord const& rec) noexcept {
+        switch (rec.op) {
+        case TraceRecord::read:
+        case TraceRecord::write:
+        case TraceRecord::free:
+            return !rec.result;
+        case TraceRecord::alloc:
+            return rec.result != static_cast<uint8_t>(STM::Alloc::success) && rec.result != static_cast<uint8_t>(STM::Alloc::nomem);
+        default:
+            return false;
+        }
+    }
+public:
+    TraceHeader header;
+    ::std::vector<::std::vector<TraceRecord>> threads;  // Records of each thread, in call order
+    ::std::vector<::std::vector<Attempt>>     attempts; // Attempts of each thread, in call order
+    uint32_t nbsegments; // Number of segment identifiers used
+    ::std::vector<uint_fast64_t> users;  // Number of attempts using each segment before its (committed) free
+    ::std::vector<bool>          usable; // Whether each segment was allocated by a committed transaction (or is the first one)
+    size_t maxsize; // Largest read/write size (in bytes)
+public:
+    /** Load a trace file.
+     * @param path Path of the trace file
+    **/
+    Trace(char const* path): nbsegments{1}, maxsize{0} {
+        ::std::ifstream file{path, ::std::ios::binary};
+        if (unlikely(!file))
+            throw Exception::TraceOpen{};
+        if (unlikely(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || ::std::memcmp(header.magic, TraceHeader::magic_value, sizeof(header.magic)) != 0))
+            throw Exception::TraceFormat{};
+        for (uint64_t i = 0; i < header.nbrecords; ++i) {
+            TraceRecord rec;
+            if (unlikely(!file.read(reinterpret_cast<char*>(&rec), sizeof(rec))))
+                break; // Truncated trace, keep what was read
+            if (rec.thread >= threads.size())
+                threads.resize(rec.thread + 1);
+            threads[rec.thread].push_back(rec);
+            if (rec.segment != TraceRecord::no_segment)
+                nbsegments = ::std::max(nbsegments, rec.segment + 1);
+            if (rec.op == TraceRecord::read || rec.op == TraceRecord::write)
+                maxsize = ::std::max(maxsize, static_cast<size_t>(rec.size));
+        }
+        // Split into attempts
+        attempts.resize(threads.size());
+        for (size_t t = 0; t < threads.size(); ++t) {
+            auto const& recs = threads[t];
+            auto open = false;
+            for (size_t r = 0; r < recs.size(); ++r) {
+                auto const& rec = recs[r];
+                if (rec.op == TraceRecord::begin) {
+                    if (open) // Previous attempt never finished
+                        attempts[t].back().last = r;
+                    open = rec.result; // Failed 'begin': no attempt
+                    if (open)
+                        attempts[t].push_back(Attempt{r, recs.size(), false, false, {}, {}, {}});
+                } else if (open && (rec.op == TraceRecord::end || failed(rec))) {
+                    auto& attempt = attempts[t].back();
+                    attempt.last = r + 1;
+                    attempt.ended = rec.op == TraceRecord::end;
+                    attempt.committed = attempt.ended && rec.result;
+                    open = false;
+                }
+            }
+        }
+        // Segments allocated by committed transactions, and the time of their (committed) free
+        constexpr auto never = UINT64_MAX;
+        usable.assign(nbsegments, false);
+        usable[0] = true;
+        ::std::vector<uint64_t> freed_at(nbsegments, never);
+        for (size_t t = 0; t < threads.size(); ++t) {
+            for (auto const& attempt: attempts[t]) {
+                if (!attempt.committed)
+                    continue;
+                for (auto r = attempt.first; r < attempt.last; ++r) {
+                    auto const& rec = threads[t][r];
+                    if (rec.op == TraceRecord::alloc && rec.segment != TraceRecord::no_segment) {
+                        usable[rec.segment] = true;
+                    } else if (rec.op == TraceRecord::free && rec.segment != TraceRecord::no_segment) {
+                        freed_at[rec.segment] = ::std::min(freed_at[rec.segment], rec.time);
+                    }
+                }
+            }
+        }
+        // Dependencies of each attempt
+        users.assign(nbsegments, 0);
+        for (size_t t = 0; t < threads.size(); ++t) {
+            for (auto& attempt: attempts[t]) {
+                ::std::vector<uint32_t> allocated;
+                for (auto r = attempt.first; r < attempt.last; ++r) {
+                    auto const& rec = threads[t][r];
+                    if (rec.segment == TraceRecord::no_segment || !usable[rec.segment])
+                        continue;
+                    if (rec.op == TraceRecord::alloc) {
+                        allocated.push_back(rec.segment);
+                        continue;
+                    }
+                    if (rec.op == TraceRecord::free && attempt.committed) {
+                        attempt.frees.push_back(rec.segment);
+                    } else if (rec.time < freed_at[rec.segment]) { // Accesses after the free are stale (and skipped)
+                        attempt.releases.push_back(rec.segment);
+                    }
+                    if (rec.segment != 0 && ::std::find(allocated.begin(), allocated.end(), rec.segment) == allocated.end())
+                        attempt.needs.push_back(rec.segment);
+                }
+                for (auto list: {&attempt.needs, &attempt.frees, &attempt.releases}) {
+                    ::std::sort(list->begin(), list->end());
+                    list->erase(::std::unique(list->begin(), list->end()), list->end());
+                }
+                attempt.releases.erase(::std::remove_if(attempt.releases.begin(), attempt.releases.end(), [&](auto s) {
+                    return ::std::binary_search(attempt.frees.begin(), attempt.frees.end(), s); // Not waiting for itself
+                }), attempt.releases.end());
+                for (auto s: attempt.releases)
+                    ++users[s];
+            }
+        }
+    }
+public:
+    /** Get the number of records.
+     * @return Number of records
+    **/
+    auto nbrecords() const noexcept {
+        size_t res = 0;
+        for (auto const& recs: threads)
+            res += recs.size();
+        return res;
+    }
+    /** Replay the trace on a transactional library, with one thread per recorded thread.
+     * Every attempt that committed when recorded is retried until it commits; an attempt that aborted when recorded is
+     * replayed up to the call that failed, then ended (i.e. committed) if the library did not abort it. Data read and
+     * written are meaningless: only the operation stream is reproduced.
+     * @param tl    Transactional library to use
+     * @param timed Whether to wait for each call's recorded time (instead of running at full speed)
+     * @return Replay outcome
+    **/
+    Outcome replay(TransactionalLibrary const& tl, bool timed) const {
+        TransactionalMemory tm{tl, header.align, header.size};
+        ThreadRegistration registration{tm};
+        auto addrs  = ::std::make_unique<::std::atomic<void*>[]>(nbsegments);
+        auto states = ::std::make_unique<::std::atomic<State>[]>(nbsegments);
+        auto left   = ::std::make_unique<::std::atomic<uint_fast64_t>[]>(nbsegments); // Attempts still to release each segment
+        for (uint32_t s = 0; s < nbsegments; ++s) {
+            addrs[s].store(s == 0 ? tm.get_start() : nullptr, ::std::memory_order_relaxed);
+            states[s].store(s == 0 ? State::published : State::pending, ::std::memory_order_relaxed);
+            left[s].store(users[s], ::std::memory_order_relaxed);
+        }
+        Outcome res{0, 0, 0, 0, 0, 0};
+        ::std::atomic<uint_fast64_t> calls{0}, commits{0}, aborts{0}, divergences{0}, skipped{0};
+        ::std::atomic<bool>        go{false};
+        ::std::atomic<bool>        failure{false};
+        ::std::chrono::steady_clock::time_point origin;
+        auto const worker = [&](size_t t) {
+            try {
+                ThreadRegistration registration{tm};
+                auto const& recs = threads[t];
+                ::std::vector<char> buffer(::std::max(maxsize, static_cast<size_t>(header.align)));
+                ::std::vector<::std::pair<uint32_t, void*>> allocated; // Segments allocated by the running attempt
+                uint_fast64_t nbcalls = 0, nbcommits = 0, nbaborts = 0, nbdivergences = 0, nbskipped = 0;
+                while (!go.load(::std::memory_order_acquire))
+                    ::std::this_thread::yield();
+                auto const wait = [&](auto&& blocked) { // Whether the condition cleared, instead of another worker failing
+                    while (blocked()) {
+                        if (unlikely(failure.load(::std::memory_order_relaxed)))
+                            return false;
+                        ::std::this_thread::yield();
+                    }
+                    return true;
+                };
+                for (auto const& attempt: attempts[t]) {
+                    for (auto s: attempt.needs) { // Outside of any transaction, as a library may serialize them
+                        if (unlikely(!wait([&]() { return states[s].load(::std::memory_order_acquire) == State::pending; })))
+                            return;
+                    }
+                    for (auto s: attempt.frees) {
+                        if (unlikely(!wait([&]() { return left[s].load(::std::memory_order_acquire) > 0; })))
+                            return;
+                    }
+                    while (true) { // Until the attempt ends as when recorded
+                        allocated.clear();
+                        if (timed)
+                            ::std::this_thread::sleep_until(origin + ::std::chrono::nanoseconds{recs[attempt.first].time});
+                        auto tx = tm.begin(recs[attempt.first].ro);
+                        ++nbcalls;
+                        if (unlikely(tx == STM::invalid_tx))
+                            throw Exception::TransactionBegin{};
+                        auto alive = true;
+                        for (auto r = attempt.first + 1; alive && r < attempt.last; ++r) {
+                            auto const& rec = recs[r];
+                            if (rec.op == TraceRecord::end)
+                                break;
+                            if (timed)
+                                ::std::this_thread::sleep_until(origin + ::std::chrono::nanoseconds{rec.time});
+                            if (rec.op == TraceRecord::alloc) {
+                                void* target;
+                                ++nbcalls;
+                                switch (tm.alloc(tx, rec.size, &target)) {
+                                case STM::Alloc::success:
+                                    if (rec.segment != TraceRecord::no_segment)
+                                        allocated.emplace_back(rec.segment, target);
+                                    break;
+                                case STM::Alloc::nomem:
+                                    break;
+                                default:
+                                    alive = false;
+                                }
+                                continue;
+                            }
+                            // Address in the replayed region
+                            char* addr = nullptr;
+                            if (rec.segment != TraceRecord::no_segment && usable[rec.segment] && (rec.op != TraceRecord::free || attempt.committed)) {
+                                for (auto const& seg: allocated) {
+                                    if (seg.first == rec.segment)
+                                        addr = static_cast<char*>(seg.second);
+                                }
+                                if (!addr && states[rec.segment].load(::std::memory_order_acquire) == State::published)
+                                    addr = static_cast<char*>(addrs[rec.segment].load(::std::memory_order_relaxed));
+                            }
+                            if (!addr) {
+                                ++nbskipped;
+                                continue;
+                            }
+                            ++nbcalls;
+                            switch (rec.op) {
+                            case TraceRecord::read:
+                                alive = tm.read(tx, addr + rec.offset, rec.size, buffer.data());
+                                break;
+                            case TraceRecord::write:
+                                alive = tm.write(tx, buffer.data(), rec.size, addr + rec.offset);
+                                break;
+                            case TraceRecord::free:
+                                alive = tm.free(tx, addr);
+                                break;
+                            }
+                        }
+                        auto committed = false;
+                        if (alive) {
+                            if (!attempt.ended) // Aborted when recorded, but not now
+                                ++nbdivergences;
+                            if (timed && attempt.ended)
+                                ::std::this_thread::sleep_until(origin + ::std::chrono::nanoseconds{recs[attempt.last - 1].time});
+                            committed = tm.end(tx);
+                            ++nbcalls;
+                        }
+                        if (committed) {
+                            ++nbcommits;
+                            for (auto const& seg: allocated) {
+                                addrs[seg.first].store(seg.second, ::std::memory_order_relaxed);
+                                states[seg.first].store(State::published, ::std::memory_order_release);
+                            }
+                            for (auto s: attempt.frees)
+                                states[s].store(State::freed, ::std::memory_order_release);
+                        }
+                        if (committed || !attempt.committed)
+                            break;
+                        if (unlikely(failure.load(::std::memory_order_relaxed))) // No need to commit anymore
+                            return;
+                        ++nbaborts;
+                    }
+                    for (auto s: attempt.releases)
+                        left[s].fetch_sub(1, ::std::memory_order_release);
+                }
+                calls.fetch_add(nbcalls, ::std::memory_order_relaxed);
+                commits.fetch_add(nbcommits, ::std::memory_order_relaxed);
+                aborts.fetch_add(nbaborts, ::std::memory_order_relaxed);
+                divergences.fetch_add(nbdivergences, ::std::memory_order_relaxed);
+                skipped.fetch_add(nbskipped, ::std::memory_order_relaxed);
+            } catch (::std::exception const&) {
+                failure.store(true, ::std::memory_order_relaxed);
+            }
+        };
+        ::std::vector<::std::thread> workers;
+        for (size_t t = 0; t < threads.size(); ++t)
+            workers.emplace_back(worker, t);
+        Chrono chrono;
+        chrono.start();
+        origin = ::std::chrono::steady_clock::now();
+        go.store(true, ::std::memory_order_release);
+        for (auto& thread: workers)
+            thread.join();
+        res.time = chrono.delta();
+        if (unlikely(failure.load(::std::memory_order_relaxed)))
+            throw Exception::TraceReplay{};
+        res.calls       = calls.load(::std::memory_order_relaxed);
+        res.commits     = commits.load(::std::memory_order_relaxed);
+        res.aborts      = aborts.load(::std::memory_order_relaxed);
+        res.divergences = divergences.load(::std::memory_order_relaxed);
+        res.skipped     = skipped.load(::std::memory_order_relaxed);
+        return res;
+    }
+};
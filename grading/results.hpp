@@ -0,0 +1,234 @@
+/**
+ * @file   results.hpp
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version. Please see https://gnu.org/licenses/gpl.html
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * History of the measurements (CSV file) and regression detection against a baseline revision.
+**/
+
+#pragma once
+
+// External headers
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+extern "C" {
+#include <unistd.h>
+}
+
+// Internal headers
+#include "common.hpp"
+
+// -------------------------------------------------------------------------- //
+
+/** Outcome of a two-sided Mann-Whitney U test.
+**/
+class MannWhitney final {
+public:
+    double u;      // U statistic of the first sample
+    double z;      // Normal approximation (tie-corrected), positive when the first sample tends to be larger
+    double pvalue; // Two-sided p-value
+public:
+    /** Compare two samples.
+     * @param a First sample
+     * @param b Second sample
+     * @return Test outcome (p-value of 1 if a sample is empty)
+    **/
+    static MannWhitney test(::std::vector<double> const& a, ::std::vector<double> const& b) {
+        MannWhitney res{0., 0., 1.};
+        if (unlikely(a.empty() || b.empty()))
+            return res;
+        ::std::vector<::std::pair<double, bool>> all; // Value, whether it comes from 'a'
+        all.reserve(a.size() + b.size());
+        for (auto x: a)
+            all.emplace_back(x, true);
+        for (auto x: b)
+            all.emplace_back(x, false);
+        ::std::sort(all.begin(), all.end());
+        auto const n1 = static_cast<double>(a.size());
+        auto const n2 = static_cast<double>(b.size());
+        auto const n  = n1 + n2;
+        double ranks = 0.; // Sum of the ranks of 'a'
+        double ties  = 0.; // Sum of t^3 - t over the groups of ties
+        for (size_t i = 0; i < all.size();) {
+            auto j = i;
+            while (j < all.size() && all[j].first == all[i].first)
+                ++j;
+            auto const rank = static_cast<double>(i + j + 1) / 2.; // Average 1-based rank of the group
+            for (auto k = i; k < j; ++k) {
+                if (all[k].second)
+                    ranks += rank;
+            }
+            auto const t = static_cast<double>(j - i);
+            ties += t * t * t - t;
+            i = j;
+        }
+        res.u = ranks - n1 * (n1 + 1.) / 2.;
+        auto const variance = n1 * n2 / 12. * ((n + 1.) - ties / (n * (n - 1.)));
+        if (variance <= 0.)
+            return res;
+        auto const delta = res.u - n1 * n2 / 2.;
+        auto const corrected = delta > 0.5 ? delta - 0.5 : (delta < -0.5 ? delta + 0.5 : 0.); // Continuity correction
+        res.z = corrected / ::std::sqrt(variance);
+        res.pvalue = ::std::erfc(::std::fabs(res.z) / ::std::sqrt(2.));
+        return res;
+    }
+};
+
+/** Append-only CSV history of the measured runs, one row per library evaluation.
+ * Columns: timestamp, revision, machine, configuration, library, metric, then the samples separated by ';'.
+**/
+class ResultsStore final {
+private:
+    /** Quote a field for CSV.
+     * @param field Field to quote
+     * @return Quoted field
+    **/
+    static ::std::string quote(::std::string const& field) {
+        ::std::string res{"\""};
+        for (auto c: field) {
+            if (c == '"')
+                res += '"';
+            res += c;
+        }
+        res += '"';
+        return res;
+    }
+    /** Split one CSV line into its fields.
+     * @param line Line to split
+     * @return Unquoted fields
+    **/
+    static ::std::vector<::std::string> split(::std::string const& line) {
+        ::std::vector<::std::string> res(1);
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); ++i) {
+            auto c = line[i];
+            if (quoted) {
+                if (c == '"') {
+                    if (i + 1 < line.size() && line[i + 1] == '"') {
+                        res.back() += '"';
+                        ++i;
+                    } else {
+                        quoted = false;
+                    }
+                } else {
+                    res.back() += c;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                res.emplace_back();
+            } else {
+                res.back() += c;
+            }
+        }
+        return res;
+    }
+    /** Run a shell command and get the first line of its output.
+     * @param command Command to run
+     * @return First line, empty on failure
+    **/
+    static ::std::string first_line(::std::string const& command) {
+        auto pipe = ::popen(command.c_str(), "r");
+        if (unlikely(!pipe))
+            return {};
+        char buffer[256];
+        ::std::string res;
+        if (::fgets(buffer, sizeof(buffer), pipe))
+            res = buffer;
+        ::pclose(pipe);
+        while (!res.empty() && (res.back() == '\n' || res.back() == '\r'))
+            res.pop_back();
+        return res;
+    }
+private:
+    ::std::string path;
+public:
+    ::std::string revision; // Revision the measured libraries were built from
+    ::std::string machine;  // Host name, CPU model and number of hardware threads
+    ::std::string config;   // Workload parameters, rows of different configurations are never compared
+public:
+    /** Bind the store to a file, and identify the current revision and machine.
+     * @param path   Path of the CSV file, created on first append
+     * @param config Description of the workload parameters
+    **/
+    ResultsStore(char const* path, ::std::string config): path{path}, config{::std::move(config)} {
+        auto env = ::std::getenv("GRADING_REVISION");
+        revision = env ? env : first_line("git describe --always --dirty 2>/dev/null");
+        if (revision.empty())
+            revision = "unknown";
+        char host[256] = "unknown";
+        ::gethostname(host, sizeof(host) - 1);
+        ::std::string cpu{"unknown"};
+        ::std::ifstream cpuinfo{"/proc/cpuinfo"};
+        for (::std::string line; ::std::getline(cpuinfo, line);) {
+            if (line.compare(0, 10, "model name") == 0) {
+                auto pos = line.find(": ");
+                if (pos != ::std::string::npos)
+                    cpu = line.substr(pos + 2);
+                break;
+            }
+        }
+        machine = ::std::string{host} + " / " + cpu + " / " + ::std::to_string(::std::thread::hardware_concurrency()) + " threads";
+    }
+    /** Append the samples of one library evaluation.
+     * @param library Library path, as given on the command line
+     * @param metric  Name of the metric
+     * @param samples Samples to record
+     * @return Whether the row was written
+    **/
+    bool append(::std::string const& library, char const* metric, ::std::vector<double> const& samples) const {
+        ::std::ofstream file{path, ::std::ios::app};
+        if (unlikely(!file))
+            return false;
+        char stamp[32];
+        auto now = ::std::time(nullptr);
+        ::std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", ::std::gmtime(&now));
+        ::std::ostringstream values;
+        values << ::std::fixed << ::std::setprecision(0); // Samples are in ns
+        for (size_t i = 0; i < samples.size(); ++i)
+            values << (i > 0 ? ";" : "") << samples[i];
+        file << stamp << ',' << quote(revision) << ',' << quote(machine) << ',' << quote(config) << ',' << quote(library) << ',' << metric << ',' << values.str() << '\n';
+        return static_cast<bool>(file);
+    }
+    /** Collect every recorded sample of a baseline revision, on this machine and configuration.
+     * @param baseline Revision to collect
+     * @param library  Library path, as given on the command line
+     * @param metric   Name of the metric
+     * @return Samples of all the matching rows
+    **/
+    ::std::vector<double> load(::std::string const& baseline, ::std::string const& library, char const* metric) const {
+        ::std::vector<double> res;
+        ::std::ifstream file{path};
+        for (::std::string line; ::std::getline(file, line);) {
+            auto fields = split(line);
+            if (fields.size() != 7 || fields[1] != baseline || fields[2] != machine || fields[3] != config || fields[4] != library || fields[5] != metric)
+                continue;
+            ::std::istringstream values{fields[6]};
+            for (::std::string value; ::std::getline(values, value, ';');) {
+                if (!value.empty())
+                    res.push_back(::std::stod(value));
+            }
+        }
+        return res;
+    }
+};
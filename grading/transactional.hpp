@@ -24,6 +24,8 @@
 #pragma once
 
 // External headers
+#include <cstdint>
+#include <map>
 extern "C" {
 #include <dlfcn.h>
 #include <limits.h>
@@ -60,6 +62,10 @@ EXCEPTION(Shared, Any, "operation in shared memory exception");
     EXCEPTION(SharedOverflow, Shared, "index is past array length");
     EXCEPTION(SharedDoubleAlloc, Shared, "(probable) double allocation detected before transactional operation");
     EXCEPTION(SharedDoubleFree, Shared, "double free detected before transactional operation");
+EXCEPTION(Trace, Any, "trace exception");
+    EXCEPTION(TraceOpen, Trace, "unable to open the trace file");
+    EXCEPTION(TraceFormat, Trace, "not a transactional memory trace");
+    EXCEPTION(TraceReplay, Trace, "trace replay failed in some thread(s)");
 
 }
 // -------------------------------------------------------------------------- //
@@ -82,6 +88,8 @@ private:
     using FnWrite   = decltype(&STM::tm_write);
     using FnAlloc   = decltype(&STM::tm_alloc);
     using FnFree    = decltype(&STM::tm_free);
+    using FnEnter   = decltype(&STM::tm_thread_enter);
+    using FnExit    = decltype(&STM::tm_thread_exit);
 private:
     void*     module;     // Module opaque handler
     FnCreate  tm_create;  // Module's initialization function
@@ -95,6 +103,8 @@ private:
     FnWrite   tm_write;   // Module's shared memory write function
     FnAlloc   tm_alloc;   // Module's shared memory allocation function
     FnFree    tm_free;    // Module's shared memory freeing function
+    FnEnter   tm_thread_enter; // Module's thread registration function (optional, 'nullptr' if not exported)
+    FnExit    tm_thread_exit;  // Module's thread unregistration function (optional, 'nullptr' if not exported)
 private:
     /** Solve a symbol from its name, and bind it to the given function.
      * @param name Name of the symbol to resolve
@@ -109,6 +119,14 @@ private:
     template<class Signature> void solve(char const* name, Signature& func) const {
         func = solve<Signature>(name);
     }
+    /** Solve an optional symbol from its name, and bind it to the given function ('nullptr' if not found).
+     * @param name Name of the symbol to resolve
+     * @param func Target function to bind
+    **/
+    template<class Signature> void solve_optional(char const* name, Signature& func) const {
+        auto res = ::dlsym(module, name);
+        func = res ? *reinterpret_cast<Signature*>(&res) : nullptr;
+    }
 public:
     /** Loader constructor.
      * @param path  Path to the library to load
@@ -136,6 +154,8 @@ public:
             solve("tm_write", tm_write);
             solve("tm_alloc", tm_alloc);
             solve("tm_free", tm_free);
+            solve_optional("tm_thread_enter", tm_thread_enter);
+            solve_optional("tm_thread_exit", tm_thread_exit);
         }
     }
     /** Unloader destructor.
@@ -145,6 +165,140 @@ public:
     }
 };
 
+/** One call to the transactional library in a trace, with addresses relative to the segments.
+**/
+struct TraceRecord {
+    /** Traced operation.
+    **/
+    enum Op: uint8_t {
+        begin,
+        end,
+        read,
+        write,
+        alloc,
+        free
+    };
+    constexpr static uint32_t no_segment = UINT32_MAX; // Address outside of every known segment, or failed allocation
+    uint64_t time;    // Time of the call since the start of the recording (in ns)
+    uint32_t thread;  // Calling thread, numbered in order of first call
+    uint32_t segment; // Segment accessed/allocated/freed, numbered in allocation order from 0 (the first segment)
+    uint32_t offset;  // Offset in the segment (in bytes)
+    uint32_t size;    // Size read/written/allocated (in bytes)
+    uint8_t  op;      // Operation
+    uint8_t  result;  // Whether the call succeeded, or the 'STM::Alloc' value for 'alloc'
+    uint8_t  ro;      // Whether the transaction is read-only ('begin' only)
+    uint8_t  padding[5];
+};
+static_assert(sizeof(TraceRecord) == 32, "unexpected trace record layout");
+
+/** Header of a trace file, followed by the records.
+**/
+struct TraceHeader {
+    constexpr static char magic_value[8] = {'T', 'M', 'T', 'R', 'A', 'C', 'E', '1'};
+    char     magic[8];
+    uint64_t align;     // Alignment of the shared memory region (in bytes)
+    uint64_t size;      // Size of the first segment (in bytes)
+    uint64_t nbrecords; // Number of records that follow
+};
+
+/** Recorder of every call made through one transactional memory, in a binary trace file.
+**/
+class TraceRecorder final: private NonCopyable {
+private:
+    /** Known segment.
+    **/
+    struct Segment {
+        uint32_t id;
+        size_t   size;
+    };
+private:
+    inline static ::std::atomic<TraceRecorder*> armed{nullptr}; // Recorder waiting for the next transactional memory
+    ::std::mutex lock; // Guards everything below
+    ::std::ofstream file;
+    TraceHeader header;
+    ::std::map<uintptr_t, Segment> segments; // Base address -> segment, entries only replaced on address reuse
+    uint32_t nbsegments;
+    uint32_t nbthreads;
+    Chrono origin; // Started at the creation of the recorded transactional memory
+public:
+    /** Open the trace file, and arm the recorder for the next transactional memory to be created.
+     * @param path Path of the trace file
+    **/
+    TraceRecorder(char const* path): file{path, ::std::ios::binary | ::std::ios::trunc}, header{}, nbsegments{0}, nbthreads{0} {
+        if (unlikely(!file))
+            throw Exception::TraceOpen{};
+        ::std::memcpy(header.magic, TraceHeader::magic_value, sizeof(header.magic));
+        file.write(reinterpret_cast<char const*>(&header), sizeof(header)); // Completed when closing
+        armed.store(this, ::std::memory_order_release);
+    }
+    /** Complete the header and close the trace file.
+    **/
+    ~TraceRecorder() {
+        TraceRecorder* self = this;
+        armed.compare_exchange_strong(self, nullptr, ::std::memory_order_relaxed);
+        file.seekp(0);
+        file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    }
+public:
+    /** Take the armed recorder, if any, for a newly created transactional memory.
+     * @param align Shared memory region alignment
+     * @param size  First segment size
+     * @param start First segment start address
+     * @return Recorder to use, 'nullptr' for none
+    **/
+    static TraceRecorder* claim(size_t align, size_t size, void* start) noexcept {
+        auto res = armed.exchange(nullptr, ::std::memory_order_acq_rel);
+        if (res) {
+            ::std::unique_lock<decltype(lock)> guard{res->lock};
+            res->header.align = align;
+            res->header.size  = size;
+            res->segments[reinterpret_cast<uintptr_t>(start)] = Segment{res->nbsegments++, size};
+            res->origin.start();
+        }
+        return res;
+    }
+    /** Record one call.
+     * @param op     Operation
+     * @param result Call result
+     * @param addr   Address accessed, allocated or freed ('nullptr' if irrelevant)
+     * @param size   Size read, written or allocated (0 if irrelevant)
+     * @param ro     Whether the transaction is read-only ('begin' only)
+    **/
+    void record(TraceRecord::Op op, uint8_t result, void const* addr = nullptr, size_t size = 0, bool ro = false) noexcept {
+        thread_local TraceRecorder* owner = nullptr; // Recorder the thread number below was given by
+        thread_local uint32_t thread = 0;
+        TraceRecord rec;
+        ::std::memset(&rec, 0, sizeof(rec));
+        rec.time   = origin.delta();
+        rec.op     = op;
+        rec.result = result;
+        rec.size   = static_cast<uint32_t>(size);
+        rec.ro     = ro;
+        rec.segment = TraceRecord::no_segment;
+        ::std::unique_lock<decltype(lock)> guard{lock};
+        if (owner != this) {
+            owner  = this;
+            thread = nbthreads++;
+        }
+        rec.thread = thread;
+        auto base = reinterpret_cast<uintptr_t>(addr);
+        if (op == TraceRecord::alloc) {
+            if (result == static_cast<uint8_t>(STM::Alloc::success)) {
+                rec.segment = nbsegments++;
+                segments[base] = Segment{rec.segment, size};
+            }
+        } else if (addr) {
+            auto it = segments.upper_bound(base);
+            if (it != segments.begin() && base - (--it)->first < it->second.size) {
+                rec.segment = it->second.id;
+                rec.offset  = static_cast<uint32_t>(base - it->first);
+            }
+        }
+        file.write(reinterpret_cast<char const*>(&rec), sizeof(rec));
+        ++header.nbrecords;
+    }
+};
+
 /** One shared memory region management class.
 **/
 class TransactionalMemory final: private NonCopyable {
@@ -167,6 +321,7 @@ private:
     void*  start_addr; // Shared memory region first segment's start address
     size_t start_size; // Shared memory region first segment's size (in bytes)
     size_t alignment;  // Shared memory region alignment (in bytes)
+    TraceRecorder* recorder; // Recorder of every call, 'nullptr' for none
 public:
     /** Bind constructor.
      * @param library Transactional library to use
@@ -182,6 +337,7 @@ public:
                 throw Exception::TransactionCreate{};
             start_addr = tl.tm_start(shared);
         }, "The transactional library takes too long creating the shared memory");
+        recorder = TraceRecorder::claim(align, size, start_addr);
     }
     /** Unbind destructor.
     **/
@@ -209,20 +365,39 @@ public:
     auto get_align() const noexcept {
         return alignment;
     }
+public:
+    /** [thread-safe] Register the calling thread on the shared memory region, no-op if the library does not support it.
+     * @return Whether the thread is registered
+    **/
+    auto thread_enter() const noexcept {
+        return tl.tm_thread_enter ? tl.tm_thread_enter(shared) : false;
+    }
+    /** [thread-safe] Unregister the calling thread from the shared memory region, no-op if the library does not support it.
+    **/
+    void thread_exit() const noexcept {
+        if (tl.tm_thread_exit)
+            tl.tm_thread_exit(shared);
+    }
 public:
     /** [thread-safe] Begin a new transaction on the shared memory region.
      * @param ro Whether the transaction is read-only
      * @return Opaque transaction ID, 'STM::invalid_tx' on failure
     **/
     auto begin(bool ro) const noexcept {
-        return tl.tm_begin(shared, ro);
+        auto res = tl.tm_begin(shared, ro);
+        if (unlikely(recorder))
+            recorder->record(TraceRecord::begin, res != STM::invalid_tx, nullptr, 0, ro);
+        return res;
     }
     /** [thread-safe] End the given transaction.
      * @param tx Opaque transaction ID
      * @return Whether the whole transaction is a success
     **/
     auto end(TX tx) const noexcept {
-        return tl.tm_end(shared, tx);
+        auto res = tl.tm_end(shared, tx);
+        if (unlikely(recorder))
+            recorder->record(TraceRecord::end, res);
+        return res;
     }
     /** [thread-safe] Read operation in the given transaction, source in the shared region and target in a private region.
      * @param tx     Transaction to use
@@ -232,7 +407,10 @@ public:
      * @return Whether the whole transaction can continue
     **/
     auto read(TX tx, void const* source, size_t size, void* target) const noexcept {
-        return tl.tm_read(shared, tx, source, size, target);
+        auto res = tl.tm_read(shared, tx, source, size, target);
+        if (unlikely(recorder))
+            recorder->record(TraceRecord::read, res, source, size);
+        return res;
     }
     /** [thread-safe] Write operation in the given transaction, source in a private region and target in the shared region.
      * @param tx     Transaction to use
@@ -242,7 +420,10 @@ public:
      * @return Whether the whole transaction can continue
     **/
     auto write(TX tx, void const* source, size_t size, void* target) const noexcept {
-        return tl.tm_write(shared, tx, source, size, target);
+        auto res = tl.tm_write(shared, tx, source, size, target);
+        if (unlikely(recorder))
+            recorder->record(TraceRecord::write, res, target, size);
+        return res;
     }
     /** [thread-safe] Memory allocation operation in the given transaction, throw if no memory available.
      * @param tx     Transaction to use
@@ -251,7 +432,10 @@ public:
      * @return Allocation status
     **/
     auto alloc(TX tx, size_t size, void** target) const noexcept {
-        return tl.tm_alloc(shared, tx, size, target);
+        auto res = tl.tm_alloc(shared, tx, size, target);
+        if (unlikely(recorder))
+            recorder->record(TraceRecord::alloc, static_cast<uint8_t>(res), res == STM::Alloc::success ? *target : nullptr, size);
+        return res;
     }
     /** [thread-safe] Memory freeing operation in the given transaction.
      * @param tx     Transaction to use
@@ -259,7 +443,29 @@ public:
      * @return Whether the whole transaction can continue
     **/
     auto free(TX tx, void* target) const noexcept {
-        return tl.tm_free(shared, tx, target);
+        auto res = tl.tm_free(shared, tx, target);
+        if (unlikely(recorder))
+            recorder->record(TraceRecord::free, res, target);
+        return res;
+    }
+};
+
+/** Thread registration over a shared memory region management class.
+**/
+class ThreadRegistration final: private NonCopyable {
+private:
+    TransactionalMemory const& tm; // Bound transactional memory
+public:
+    /** Enter constructor.
+     * @param tm Transactional memory to register on
+    **/
+    ThreadRegistration(TransactionalMemory const& tm): tm{tm} {
+        tm.thread_enter();
+    }
+    /** Exit destructor.
+    **/
+    ~ThreadRegistration() noexcept {
+        tm.thread_exit();
     }
 };
 
@@ -24,6 +24,7 @@
 #pragma once
 
 // External headers
+#include <cmath>
 #include <cstdint>
 #include <random>
 
@@ -60,6 +61,13 @@ public:
     /** Virtual destructor.
     **/
     virtual ~Workload() {};
+public:
+    /** Get the built transactional memory.
+     * @return Transactional memory in use
+    **/
+    auto const& get_tm() const noexcept {
+        return tm;
+    }
 public:
     /** Shared memory (re)initialization.
      * @return Constant null-terminated error message, 'nullptr' for none
@@ -77,6 +85,63 @@ public:
      * @return Constant null-terminated error message, 'nullptr' for none
     **/
     virtual char const* check(Uid, Seed) const = 0;
+    /** Expected amount of shared data kept live by the workload.
+     * @return Size of the live shared data (in bytes)
+    **/
+    virtual size_t data_size() const = 0;
+};
+
+// -------------------------------------------------------------------------- //
+
+/** Zipfian distribution over [0, n - 1], rank 0 being the most popular, after Gray et al.'s
+ * "Quickly generating billion-record synthetic databases"; the range may change between draws.
+**/
+class ZipfDistribution final {
+private:
+    double theta; // Skew, in [0, 1)
+    size_t n;     // Current range
+    double zetan; // Generalized harmonic number of 'n'
+    double zeta2; // Generalized harmonic number of 2
+    double alpha;
+    double eta;
+    ::std::uniform_real_distribution<double> unif{0., 1.};
+private:
+    /** Move to another range, updating the harmonic number incrementally.
+     * @param count New range
+    **/
+    void resize(size_t count) {
+        while (n < count) {
+            ++n;
+            zetan += 1. / ::std::pow(static_cast<double>(n), theta);
+        }
+        while (n > count) {
+            zetan -= 1. / ::std::pow(static_cast<double>(n), theta);
+            --n;
+        }
+        eta = (1. - ::std::pow(2. / static_cast<double>(n), 1. - theta)) / (1. - zeta2 / zetan);
+    }
+public:
+    /** Distribution constructor.
+     * @param theta Skew, in [0, 1), 0 being uniform
+    **/
+    ZipfDistribution(double theta): theta{theta}, n{0}, zetan{0.}, zeta2{1. + ::std::pow(0.5, theta)}, alpha{1. / (1. - theta)}, eta{0.} {}
+    /** Draw a rank.
+     * @param engine Random engine to use
+     * @param count  Range to draw in (non-zero)
+     * @return Rank in [0, count - 1]
+    **/
+    template<class Engine> size_t operator()(Engine& engine, size_t count) {
+        if (unlikely(count != n))
+            resize(count);
+        auto u  = unif(engine);
+        auto uz = u * zetan;
+        if (uz < 1.)
+            return 0;
+        if (uz < zeta2)
+            return 1;
+        auto rank = static_cast<size_t>(static_cast<double>(n) * ::std::pow(eta * u - eta + 1., alpha));
+        return rank < n ? rank : n - 1;
+    }
 };
 
 // -------------------------------------------------------------------------- //
@@ -140,6 +205,7 @@ private:
     Balance init_balance;  // Initial account balance
     float   prob_long;     // Probability of running a long, read-only control transaction
     float   prob_alloc;    // Probability of running an allocation/deallocation transaction, knowing a long transaction won't run
+    float   skew;          // Zipfian skew of the accounts picked by short transactions, 0 for uniform
     Barrier barrier;       // Barrier for thread synchronization during 'check'
 public:
     /** Bank workload constructor.
@@ -151,8 +217,16 @@ public:
      * @param init_balance  Initial account balance
      * @param prob_long     Probability of running a long, read-only control transaction
      * @param prob_alloc    Probability of running an allocation/deallocation transaction, knowing a long transaction won't run
+     * @param skew          Zipfian skew (in [0, 1)) of the accounts picked by short transactions, 0 for uniform
+    **/
+    WorkloadBank(TransactionalLibrary const& library, size_t nbworkers, size_t nbtxperwrk, size_t nbaccounts, size_t expnbaccounts, Balance init_balance, float prob_long, float prob_alloc, float skew = 0.f): Workload{library, AccountSegment::align(), AccountSegment::size(nbaccounts)}, nbworkers{nbworkers}, nbtxperwrk{nbtxperwrk}, nbaccounts{nbaccounts}, expnbaccounts{expnbaccounts}, init_balance{init_balance}, prob_long{prob_long}, prob_alloc{prob_alloc}, skew{skew}, barrier{nbworkers} {}
+    /** Get the size of one segment of accounts.
+     * @param nbaccounts Number of accounts per segment
+     * @return Segment size (in bytes)
     **/
-    WorkloadBank(TransactionalLibrary const& library, size_t nbworkers, size_t nbtxperwrk, size_t nbaccounts, size_t expnbaccounts, Balance init_balance, float prob_long, float prob_alloc): Workload{library, AccountSegment::align(), AccountSegment::size(nbaccounts)}, nbworkers{nbworkers}, nbtxperwrk{nbtxperwrk}, nbaccounts{nbaccounts}, expnbaccounts{expnbaccounts}, init_balance{init_balance}, prob_long{prob_long}, prob_alloc{prob_alloc}, barrier{nbworkers} {}
+    constexpr static auto segment_size(size_t nbaccounts) noexcept {
+        return AccountSegment::size(nbaccounts);
+    }
 private:
     /** Long read-only transaction, summing the balance of each account.
      * @param count Loosely-updated number of accounts
@@ -292,6 +366,7 @@ public:
         ::std::bernoulli_distribution long_dist{prob_long};
         ::std::bernoulli_distribution alloc_dist{prob_alloc};
         ::std::gamma_distribution<float> alloc_trigger(expnbaccounts, 1);
+        ZipfDistribution zipf{skew};
         size_t count = nbaccounts;
         for (size_t cntr = 0; cntr < nbtxperwrk; ++cntr) {
             if (long_dist(engine)) { // Do a long transaction
@@ -299,12 +374,14 @@ public:
                     return "Violated isolation or atomicity";
             } else if (alloc_dist(engine)) { // Do an allocation transaction
                 alloc_tx(alloc_trigger(engine));
+            } else if (skew > 0.f) { // Do a short transaction on (mostly) hot accounts
+                while (unlikely(!short_tx(zipf(engine, count), zipf(engine, count))));
             } else { // Do a short transaction
                 ::std::uniform_int_distribution<size_t> account{0, count - 1};
                 while (unlikely(!short_tx(account(engine), account(engine))));
             }
         }
-        { // Last long transaction
+        if (prob_long > 0.f) { // Last long transaction, unless long transactions are disabled (e.g. not to scan every account in a data-size sweep)
             size_t dummy;
             if (!long_tx(dummy))
                 return "Violated isolation or atomicity";
@@ -360,4 +437,42 @@ public:
         }
         return nullptr;
     }
+    /** [thread-safe] Worker's batch of a soak run: the same mix as 'run', but the (de)allocation transactions all converge to a given number of accounts.
+     * @param seed    Seed to use
+     * @param nbtx    Number of transactions to run
+     * @param trigger Number of accounts to converge to
+     * @return Constant null-terminated error message, 'nullptr' for none
+    **/
+    char const* soak(Seed seed, size_t nbtx, size_t trigger) const {
+        ::std::minstd_rand engine{seed};
+        ::std::bernoulli_distribution long_dist{prob_long};
+        ::std::bernoulli_distribution alloc_dist{prob_alloc};
+        size_t count = nbaccounts;
+        for (size_t cntr = 0; cntr < nbtx; ++cntr) {
+            if (long_dist(engine)) {
+                if (unlikely(!long_tx(count)))
+                    return "Violated isolation or atomicity";
+            } else if (alloc_dist(engine)) {
+                alloc_tx(trigger);
+            } else {
+                ::std::uniform_int_distribution<size_t> account{0, count - 1};
+                while (unlikely(!short_tx(account(engine), account(engine))));
+            }
+        }
+        return nullptr;
+    }
+    /** [thread-safe] Count the allocated account segments, the first one included.
+     * @return Number of segments
+    **/
+    size_t segments() const {
+        return transactional(tm, Transaction::Mode::read_only, [&](Transaction& tx) {
+            size_t count = 0;
+            for (auto start = tm.get_start(); start; start = AccountSegment{tx, start}.next)
+                ++count;
+            return count;
+        });
+    }
+    virtual size_t data_size() const {
+        return AccountSegment::size(nbaccounts) * ((expnbaccounts + nbaccounts - 1) / nbaccounts); // Segments stay full but the last
+    }
 };
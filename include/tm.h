@@ -54,3 +54,10 @@ bool     tm_read(shared_t, tx_t, void const*, size_t, void*);
 bool     tm_write(shared_t, tx_t, void const*, size_t, void*);
 alloc_t  tm_alloc(shared_t, tx_t, size_t, void**);
 bool     tm_free(shared_t, tx_t, void*);
+
+// Optional extensions (libraries may not export these symbols)
+bool     tm_thread_enter(shared_t);
+void     tm_thread_exit(shared_t);
+bool     tm_snapshot_to_fd(shared_t, int);
+uint64_t tm_timestamp(shared_t);
+tx_t     tm_begin_at(shared_t, uint64_t);
@@ -56,3 +56,12 @@ extern "C" {
     Alloc    tm_alloc(shared_t, tx_t, size_t, void**) noexcept;
     bool     tm_free(shared_t, tx_t, void*) noexcept;
 }
+
+// Optional extensions (libraries may not export these symbols)
+extern "C" {
+    bool     tm_thread_enter(shared_t) noexcept;
+    void     tm_thread_exit(shared_t) noexcept;
+    bool     tm_snapshot_to_fd(shared_t, int) noexcept;
+    uint64_t tm_timestamp(shared_t) noexcept;
+    tx_t     tm_begin_at(shared_t, uint64_t) noexcept;
+}
@@ -0,0 +1,243 @@
+/**
+ * @file   microbench.cpp
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * any later version. Please see https://gnu.org/licenses/gpl.html
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Uncontended cost of each transactional memory operation, in isolation, for any number of libraries.
+**/
+
+// External headers
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Internal headers
+#include "common.hpp"
+#include "transactional.hpp"
+
+// -------------------------------------------------------------------------- //
+
+/** Number of words written before the read-after-write lookups.
+**/
+constexpr static size_t raw_words = 64;
+
+/** Measured operation, run once per transaction.
+**/
+class Operation final {
+public:
+    /** Kind of operation.
+    **/
+    enum class Kind {
+        empty,            // Nothing between begin and end
+        read,             // One read of 'size' bytes
+        write,            // One write of 'size' bytes
+        write_words,      // 'raw_words' writes of one word each
+        read_after_write, // 'raw_words' writes of one word each, then one read of each of them
+        alloc             // One allocation of 'size' bytes, freed in a later transaction
+    };
+public:
+    char const* name;  // Printed name
+    char const* netof; // Name of the operation whose cost is subtracted, once per transaction ('nullptr' for none)
+    Kind        kind;
+    bool        ro;    // Whether the transactions are read-only
+    size_t      align; // Alignment of the shared memory region to run on (in bytes)
+    size_t      size;  // Accessed or allocated size (in bytes)
+};
+
+/** Cost of one operation.
+**/
+class Cost final {
+public:
+    double        ns;     // Cost per transaction (in ns)
+    uint_fast64_t aborts; // Number of aborted transactions
+};
+
+/** Run one transaction until it commits.
+ * @param tm   Transactional memory to use
+ * @param ro   Whether the transaction is read-only
+ * @param cost Cost to count the aborts in
+ * @param body Transaction body (tx -> whether the transaction can continue)
+**/
+template<class Func> static void commit(TransactionalMemory const& tm, bool ro, Cost& cost, Func&& body) {
+    while (true) {
+        auto tx = tm.begin(ro);
+        if (unlikely(tx == STM::invalid_tx))
+            throw Exception::TransactionBegin{};
+        if (body(tx) && tm.end(tx))
+            return;
+        ++cost.aborts;
+    }
+}
+
+/** Measure the per-transaction cost of an operation, on a fresh shared memory region.
+ * @param tl Transactional library to use
+ * @param op Operation to measure
+ * @return Best cost over a few rounds, and the aborts of all the rounds
+**/
+static Cost measure(TransactionalLibrary const& tl, Operation const& op) {
+    constexpr auto min_round = Chrono::Tick{20000000}; // Rounds last at least 20 ms
+    constexpr auto nbrounds  = 5;
+    constexpr auto batch     = size_t{1024};           // Transactions between two looks at the clock
+    using Kind = Operation::Kind;
+    TransactionalMemory tm{tl, op.align, ::std::max(op.size, raw_words * op.align)};
+    ThreadRegistration registration{tm};
+    auto const start = reinterpret_cast<char*>(tm.get_start());
+    ::std::vector<char> buffer(::std::max(op.size, op.align));
+    ::std::vector<void*> segments;
+    segments.reserve(batch);
+    Cost res{0., 0};
+    auto const transaction = [&]() {
+        switch (op.kind) {
+        case Kind::empty:
+            commit(tm, op.ro, res, [&](auto) { return true; });
+            return;
+        case Kind::read:
+            commit(tm, op.ro, res, [&](auto tx) { return tm.read(tx, start, op.size, buffer.data()); });
+            return;
+        case Kind::write:
+            commit(tm, op.ro, res, [&](auto tx) { return tm.write(tx, buffer.data(), op.size, start); });
+            return;
+        case Kind::write_words:
+        case Kind::read_after_write:
+            commit(tm, op.ro, res, [&](auto tx) {
+                for (size_t w = 0; w < raw_words; ++w) { // Different words, so that the write set grows
+                    if (!tm.write(tx, buffer.data(), op.align, start + w * op.align))
+                        return false;
+                }
+                if (op.kind == Kind::read_after_write) {
+                    for (size_t w = 0; w < raw_words; ++w) {
+                        if (!tm.read(tx, start + w * op.align, op.align, buffer.data()))
+                            return false;
+                    }
+                }
+                return true;
+            });
+            return;
+        case Kind::alloc: {
+            void* segment; // Only valid once committed, an aborted attempt leaves no segment to free
+            commit(tm, op.ro, res, [&](auto tx) {
+                switch (tm.alloc(tx, op.size, &segment)) {
+                case STM::Alloc::success:
+                    return true;
+                case STM::Alloc::nomem:
+                    tm.end(tx);
+                    throw Exception::TransactionAlloc{};
+                default:
+                    return false;
+                }
+            });
+            segments.push_back(segment);
+            return;
+        }
+        }
+    };
+    for (auto round = 0; round < nbrounds; ++round) {
+        size_t count = 0;
+        Chrono::Tick elapsed = 0;
+        do { // Repeat batches until the round is long enough
+            Chrono chrono;
+            chrono.start();
+            for (size_t i = 0; i < batch; ++i)
+                transaction();
+            for (auto segment: segments) // Freeing transactions, counted in the same cost
+                commit(tm, false, res, [&](auto tx) { return tm.free(tx, segment); });
+            segments.clear();
+            elapsed += chrono.delta();
+            count += batch;
+        } while (elapsed < min_round);
+        auto const cost = static_cast<double>(elapsed) / static_cast<double>(count);
+        res.ns = round == 0 ? cost : ::std::min(res.ns, cost);
+    }
+    return res;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Program entry point.
+ * @param argc Arguments count
+ * @param argv Arguments values
+ * @return Program return code
+**/
+int main(int argc, char** argv) {
+    try {
+        if (unlikely(argc < 2)) {
+            ::std::cout << "Usage: " << (argc > 0 ? argv[0] : "microbench") << " <tm library path>..." << ::std::endl;
+            return 1;
+        }
+        using Kind = Operation::Kind;
+        Operation const ops[] = {
+            {"begin/end, empty RO",    nullptr,                Kind::empty,            true,  8, 0},
+            {"begin/end, empty RW",    nullptr,                Kind::empty,            false, 8, 0},
+            {"read 1 B",               "begin/end, empty RO",  Kind::read,             true,  1, 1},
+            {"read 8 B",               "begin/end, empty RO",  Kind::read,             true,  8, 8},
+            {"read 64 B",              "begin/end, empty RO",  Kind::read,             true,  8, 64},
+            {"read 4096 B",            "begin/end, empty RO",  Kind::read,             true,  8, 4096},
+            {"write 1 B",              "begin/end, empty RW",  Kind::write,            false, 1, 1},
+            {"write 8 B",              "begin/end, empty RW",  Kind::write,            false, 8, 8},
+            {"write 64 B",             "begin/end, empty RW",  Kind::write,            false, 8, 64},
+            {"write 4096 B",           "begin/end, empty RW",  Kind::write,            false, 8, 4096},
+            {"write 64 words",         "begin/end, empty RW",  Kind::write_words,      false, 8, 8},
+            {"read-after-write",       "write 64 words",       Kind::read_after_write, false, 8, 8},
+            {"alloc + free 64 B",      "begin/end, empty RW",  Kind::alloc,            false, 8, 64},
+        };
+        constexpr auto nbops = sizeof(ops) / sizeof(*ops);
+        ::std::cout << "⎧ Uncontended cost per operation (ns/op), best of 5 rounds of at least 20 ms" << ::std::endl;
+        ::std::cout << "⎩ Costs are net of the operation in parentheses; 1 B operations use a 1-byte aligned region, alloc + free is net of two empty transactions" << ::std::endl;
+        for (auto i = 1; i < argc; ++i) {
+            ::std::cout << "⎧ " << argv[i] << ::std::endl;
+            TransactionalLibrary tl{argv[i]};
+            Cost costs[nbops];
+            char const* errors[nbops] = {}; // Why an operation could not be measured, if any (e.g. unsupported alignment)
+            for (size_t o = 0; o < nbops; ++o) {
+                try {
+                    costs[o] = measure(tl, ops[o]);
+                } catch (::std::exception const& err) {
+                    errors[o] = err.what();
+                }
+            }
+            for (size_t o = 0; o < nbops; ++o) {
+                ::std::cout << (o + 1 < nbops ? "⎪ " : "⎩ ") << ::std::left << ::std::setw(22) << ops[o].name << ::std::right << ::std::setw(10);
+                auto net = costs[o].ns;
+                for (size_t b = 0; ops[o].netof && b < nbops; ++b) {
+                    if (::std::string{ops[b].name} == ops[o].netof) {
+                        net -= (ops[o].kind == Kind::alloc ? 2. : 1.) * costs[b].ns; // Allocating then freeing transaction
+                        if (!errors[o])
+                            errors[o] = errors[b];
+                    }
+                }
+                if (errors[o]) {
+                    ::std::cout << "n/a" << "  (" << errors[o] << ")" << ::std::endl;
+                    continue;
+                }
+                if (ops[o].kind == Kind::read_after_write) // One lookup per written word
+                    net /= static_cast<double>(raw_words);
+                ::std::cout << ::std::fixed << ::std::setprecision(1) << net;
+                if (ops[o].netof)
+                    ::std::cout << "  (" << ops[o].netof << ")";
+                if (costs[o].aborts > 0)
+                    ::std::cout << "  [" << costs[o].aborts << " aborts]";
+                ::std::cout << ::std::endl;
+            }
+        }
+        return 0;
+    } catch (::std::exception const& err) {
+        ::std::cerr << "⎧ *** EXCEPTION ***" << ::std::endl;
+        ::std::cerr << "⎩ " << err.what() << ::std::endl;
+        return 1;
+    }
+}
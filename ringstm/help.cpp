@@ -0,0 +1,62 @@
+#include "help.hpp"
+
+
+Signature::Signature() {
+    this->clear();
+}
+
+void Signature::clear() {
+    memset(this->bits, 0, sizeof(this->bits));
+}
+
+/** Bit of the signature a word maps to (Fibonacci hashing of its address).
+**/
+static inline size_t signature_bit(void const* word) {
+    return ((uintptr_t) word * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - 10);
+}
+static_assert(signature_bits == 1 << 10, "'signature_bit' yields 10 bits");
+
+void Signature::add(void const* word) {
+    size_t bit = signature_bit(word);
+    this->bits[bit / 64] |= UINT64_C(1) << (bit % 64);
+}
+
+bool Signature::contains(void const* word) const {
+    size_t bit = signature_bit(word);
+    return (this->bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+RingEntry::RingEntry() {
+    this->ts.store(0);
+    this->done.store(0);
+    for (size_t i = 0; i < signature_words; ++i)
+        this->bits[i].store(0);
+}
+
+EpochSlot::EpochSlot() {
+    this->running[0].store(0);
+    this->running[1].store(0);
+}
+
+TransactionObject::TransactionObject(bool is_ro, uint64_t start) {
+    this->is_ro = is_ro;
+    this->start = start;
+    this->slot = 0;
+    this->epoch = 0;
+}
+
+TransactionObject::~TransactionObject() {
+    return;
+}
+
+Region::Region(size_t size, size_t align) {
+    this->ring_index.store(0);
+    this->epoch.store(0);
+    this->start = nullptr;
+    this->size = size;
+    this->align = align;
+}
+
+Region::~Region() {
+    return;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+// External headers
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <list>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <unordered_set>
+
+// Requested features
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE   200809L
+#ifdef __STDC_NO_ATOMICS__
+    #error Current C11 compiler does not support atomic operations
+#endif
+
+// -------------------------------------------------------------------------- //
+
+/** Define a proposition as likely true.
+ * @param prop Proposition
+**/
+#undef likely
+#ifdef __GNUC__
+    #define likely(prop) \
+        __builtin_expect((prop) ? 1 : 0, 1)
+#else
+    #define likely(prop) \
+        (prop)
+#endif
+
+/** Define a proposition as likely false.
+ * @param prop Proposition
+**/
+#undef unlikely
+#ifdef __GNUC__
+    #define unlikely(prop) \
+        __builtin_expect((prop) ? 1 : 0, 0)
+#else
+    #define unlikely(prop) \
+        (prop)
+#endif
+
+/** Define one or several attributes.
+ * @param type... Attribute names
+**/
+#undef as
+#ifdef __GNUC__
+    #define as(type...) \
+        __attribute__((type))
+#else
+    #define as(type...)
+    #warning This compiler has no support for GCC attributes
+#endif
+
+#if (defined(__i386__) || defined(__x86_64__)) && defined(USE_MM_PAUSE)
+    #include <xmmintrin.h>
+#else
+    #include <sched.h>
+#endif
+/** Pause for a very short amount of time.
+**/
+static inline void short_pause() {
+#if (defined(__i386__) || defined(__x86_64__)) && defined(USE_MM_PAUSE)
+    _mm_pause();
+#else
+    sched_yield();
+#endif
+}
+
+using namespace std;
+
+// -------------------------------------------------------------------------- //
+// RingSTM: committed write sets are published as Bloom signatures in a global ring.
+// A transaction validates by intersecting its read signature with the ring entries
+// newer than its start, so there is no per-location metadata at all, and read-only
+// transactions only ever load shared state.
+
+constexpr static size_t signature_bits  = 1024;
+constexpr static size_t signature_words = signature_bits / 64;
+constexpr static size_t ring_size       = 1024; // Entries, a transaction lagging further behind aborts
+constexpr static size_t epoch_slots     = 64;   // Counters of running transactions, threads beyond that share a slot
+
+/** Bloom signature of a set of words (one hash function).
+**/
+class Signature {
+public:
+    uint64_t bits[signature_words];
+    Signature();
+    void clear();
+    void add(void const* word);
+    bool contains(void const* word) const;
+};
+
+/** Published write signature of one commit.
+ * 'ts' doubles as a sequence lock: it reads 0 while the bits are being rewritten.
+**/
+class alignas(64) RingEntry {
+public:
+    atomic<uint64_t> ts;   // Commit timestamp of the entry
+    atomic<uint64_t> done; // Timestamp of the last write-back completed in this slot
+    atomic<uint64_t> bits[signature_words];
+    RingEntry();
+    RingEntry(const RingEntry&) = delete;
+    RingEntry& operator=(const RingEntry&) = delete;
+};
+
+/** Number of running transactions of the threads of a slot, by parity of the reclamation epoch they began in.
+**/
+class alignas(64) EpochSlot {
+public:
+    atomic<uint64_t> running[2];
+    EpochSlot();
+};
+
+class TransactionObject {
+public:
+    bool is_ro;
+    uint64_t start;         // Ring index the reads are consistent with
+    size_t slot;            // Epoch slot of the transaction's thread
+    uint64_t epoch;         // Reclamation epoch the transaction began in
+    Signature reads;
+    Signature writes;
+    unordered_map<void*, size_t> index; // Word -> offset in 'redo'
+    vector<void*> order_writes;
+    vector<char> redo;      // Buffered word values, in 'order_writes' order
+    vector<void*> allocated; // Segments to free on abort
+    vector<void*> freed;     // Segments to retire on commit
+    TransactionObject(bool is_ro, uint64_t start);
+    ~TransactionObject();
+    TransactionObject(const TransactionObject&) = delete;
+    TransactionObject& operator=(const TransactionObject&) = delete;
+};
+
+class Region {
+public:
+    atomic<uint64_t> ring_index; // Timestamp of the newest ring entry
+    RingEntry ring[ring_size];
+    mutex lock_mem;
+    unordered_set<void*> memory; // Committed allocated segments, excluding the first one
+    vector<pair<void*, uint64_t>> retired; // Freed segments and the epoch they were retired in, see 'reclaim'
+    atomic<uint64_t> epoch;      // Reclamation epoch, only advanced under 'lock_mem'
+    EpochSlot epochs[epoch_slots];
+    void* start;
+    size_t size;
+    size_t align;
+    Region(size_t size, size_t align);
+    ~Region();
+};
@@ -0,0 +1,350 @@
+/**
+ * @file   tm.cpp
+ *
+ * @section LICENSE
+ *
+ * GPL 3.0
+ *
+ * @section DESCRIPTION
+ *
+ * RingSTM-style transaction manager: no per-location metadata, commit-time
+ * write signatures published in a global ring, validation by signature
+ * intersection. Writers commit one at a time (in ring order) and write back
+ * in place; read-only transactions only write the running count of their
+ * thread's epoch slot, which defers the reclamation of freed segments.
+**/
+
+#include <help.hpp>
+#include <tm.hpp>
+
+// -------------------------------------------------------------------------- //
+// Helper functions
+
+/** Epoch slot of the calling thread, handed out on first use.
+**/
+static size_t threadSlot() {
+    static atomic<size_t> next{0};
+    static thread_local size_t slot = next.fetch_add(1, memory_order_relaxed) % epoch_slots;
+    return slot;
+}
+
+/** Count a starting transaction as running in the current reclamation epoch.
+**/
+void enterEpoch(Region* reg, TransactionObject* tran) {
+    tran->slot = threadSlot();
+    EpochSlot& slot = reg->epochs[tran->slot];
+    while (true) {
+        uint64_t epoch = reg->epoch.load();
+        slot.running[epoch % 2].fetch_add(1);
+        if (likely(reg->epoch.load() == epoch)) { // Else 'reclaim' may have missed the count
+            tran->epoch = epoch;
+            return;
+        }
+        slot.running[epoch % 2].fetch_sub(1);
+    }
+}
+
+void removeT(Region* reg, TransactionObject* tran, bool failed) {
+    if (unlikely(failed)) {
+        for (void* seg: tran->allocated)
+            free(seg);
+    }
+    reg->epochs[tran->slot].running[tran->epoch % 2].fetch_sub(1, memory_order_release);
+    delete tran;
+}
+
+/** Advance the reclamation epoch if no transaction begun in the previous one still runs, then free the segments
+ * retired at least two epochs ago: every transaction that could still hold their address has ended. 'lock_mem' held.
+**/
+void reclaim(Region* reg) {
+    uint64_t epoch = reg->epoch.load();
+    bool quiescent = true;
+    for (auto& slot: reg->epochs)
+        quiescent = quiescent && slot.running[(epoch + 1) % 2].load() == 0;
+    if (quiescent)
+        reg->epoch.store(++epoch);
+    auto last = remove_if(reg->retired.begin(), reg->retired.end(), [&](auto const& seg) {
+        if (seg.second + 2 > epoch)
+            return false;
+        free(seg.first);
+        return true;
+    });
+    reg->retired.erase(last, reg->retired.end());
+}
+
+/** Hand the segments allocated and freed by a committed transaction over to the region.
+**/
+void commitSegments(Region* reg, TransactionObject* tran) {
+    if (likely(tran->allocated.empty() && tran->freed.empty()))
+        return;
+    lock_guard<mutex> lock_m(reg->lock_mem);
+    for (void* seg: tran->allocated)
+        reg->memory.insert(seg);
+    for (void* seg: tran->freed) {
+        reg->memory.erase(seg);
+        reg->retired.emplace_back(seg, reg->epoch.load());
+    }
+    if (!reg->retired.empty())
+        reclaim(reg);
+}
+
+/** Whether the ring entries in (tran->start, upto] do not intersect the read signature.
+ * Does not wait for their write-backs.
+**/
+bool validate(Region* reg, TransactionObject* tran, uint64_t upto) {
+    if (unlikely(upto - tran->start >= ring_size))
+        return false; // Entries we need have been overwritten
+    for (uint64_t ts = upto; ts > tran->start; --ts) {
+        RingEntry& entry = reg->ring[ts % ring_size];
+        uint64_t seen;
+        while (unlikely((seen = entry.ts.load(memory_order_acquire)) != ts)) {
+            if (seen > ts)
+                return false; // Lapped
+            short_pause(); // Committer has taken the slot but not published yet
+        }
+        bool conflict = false;
+        for (size_t i = 0; i < signature_words; ++i)
+            conflict |= (entry.bits[i].load(memory_order_relaxed) & tran->reads.bits[i]) != 0;
+        atomic_thread_fence(memory_order_acquire);
+        if (unlikely(entry.ts.load(memory_order_relaxed) != ts))
+            return false; // Rewritten while we were reading it
+        if (conflict)
+            return false;
+    }
+    return true;
+}
+
+/** Wait until every commit up to the given timestamp has written back.
+**/
+void waitDone(Region* reg, uint64_t ts) {
+    while (unlikely(reg->ring[ts % ring_size].done.load(memory_order_acquire) < ts))
+        short_pause();
+}
+
+/** Extend the transaction to the newest ring entry if its reads are still consistent.
+**/
+bool check(Region* reg, TransactionObject* tran) {
+    uint64_t index = reg->ring_index.load(memory_order_acquire);
+    if (likely(index == tran->start))
+        return true;
+    if (!validate(reg, tran, index))
+        return false;
+    waitDone(reg, index);
+    tran->start = index;
+    return true;
+}
+
+// -------------------------------------------------------------------------- //
+
+/** Create (i.e. allocate + init) a new shared memory region, with one first non-free-able allocated segment of the requested size and alignment.
+ * @param size  Size of the first shared segment of memory to allocate (in bytes), must be a positive multiple of the alignment
+ * @param align Alignment (in bytes, must be a power of 2) that the shared memory region must support
+ * @return Opaque shared memory region handle, 'invalid_shared' on failure
+**/
+shared_t tm_create(size_t size, size_t align) noexcept {
+    Region* reg = new Region(size, align);
+    if (unlikely(!reg)) {
+        return invalid_shared;
+    }
+    if (unlikely(posix_memalign(&(reg->start), max(align, sizeof(void*)), size) != 0)) {
+        delete reg;
+        return invalid_shared;
+    }
+    memset(reg->start, 0, size);
+    return reg;
+}
+
+/** Destroy (i.e. clean-up + free) a given shared memory region.
+ * @param shared Shared memory region to destroy, with no running transaction
+**/
+void tm_destroy(shared_t shared) noexcept {
+    Region* reg = (Region*) shared;
+    for (void* seg: reg->memory)
+        free(seg);
+    for (auto& seg: reg->retired)
+        free(seg.first);
+    free(reg->start);
+    delete reg;
+}
+
+/** [thread-safe] Return the start address of the first allocated segment in the shared memory region.
+ * @param shared Shared memory region to query
+ * @return Start address of the first allocated segment
+**/
+void* tm_start(shared_t shared) noexcept {
+    return ((Region*) shared)->start;
+}
+
+/** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
+ * @param shared Shared memory region to query
+ * @return First allocated segment size
+**/
+size_t tm_size(shared_t shared) noexcept {
+    return ((Region*) shared)->size;
+}
+
+/** [thread-safe] Return the alignment (in bytes) of the memory accesses on the given shared memory region.
+ * @param shared Shared memory region to query
+ * @return Alignment used globally
+**/
+size_t tm_align(shared_t shared) noexcept {
+    return ((Region*) shared)->align;
+}
+
+/** [thread-safe] Begin a new transaction on the given shared memory region.
+ * @param shared Shared memory region to start a transaction on
+ * @param is_ro  Whether the transaction is read-only
+ * @return Opaque transaction ID, 'invalid_tx' on failure
+**/
+tx_t tm_begin(shared_t shared, bool is_ro) noexcept {
+    Region* reg = (Region*) shared;
+    TransactionObject* tran = new TransactionObject(is_ro, 0);
+    if (unlikely(!tran)) {
+        return invalid_tx;
+    }
+    enterEpoch(reg, tran); // Before anything of the region is read
+    tran->start = reg->ring_index.load(memory_order_acquire);
+    waitDone(reg, tran->start);
+    return (tx_t) tran;
+}
+
+/** [thread-safe] End the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to end
+ * @return Whether the whole transaction committed
+**/
+bool tm_end(shared_t shared, tx_t tx) noexcept {
+    Region* reg = (Region*) shared;
+    TransactionObject* tran = (TransactionObject*) tx;
+    if (tran->order_writes.empty() && tran->freed.empty()) {
+        // Every read was validated when it happened
+        commitSegments(reg, tran);
+        removeT(reg, tran, false);
+        return true;
+    }
+    // Take the next ring slot, validating against every entry published meanwhile
+    uint64_t commit_ts = reg->ring_index.load(memory_order_acquire);
+    while (true) {
+        if (!validate(reg, tran, commit_ts)) {
+            removeT(reg, tran, true);
+            return false;
+        }
+        tran->start = commit_ts;
+        if (reg->ring_index.compare_exchange_weak(commit_ts, commit_ts + 1, memory_order_acq_rel))
+            break;
+    }
+    uint64_t ts = commit_ts + 1;
+    RingEntry& entry = reg->ring[ts % ring_size];
+    entry.ts.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < signature_words; ++i)
+        entry.bits[i].store(tran->writes.bits[i], memory_order_relaxed);
+    entry.ts.store(ts, memory_order_release);
+    // Write back in ring order, so that 'done' of an entry covers all the previous ones
+    waitDone(reg, commit_ts);
+    size_t align = reg->align;
+    for (size_t i = 0; i < tran->order_writes.size(); ++i)
+        memcpy(tran->order_writes[i], tran->redo.data() + i * align, align);
+    entry.done.store(ts, memory_order_release);
+    commitSegments(reg, tran);
+    removeT(reg, tran, false);
+    return true;
+}
+
+/** [thread-safe] Read operation in the given transaction, source in the shared region and target in a private region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in the shared region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in a private region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    Region* reg = (Region*) shared;
+    TransactionObject* tran = (TransactionObject*) tx;
+    size_t align = reg->align;
+    bool shared_read = false;
+    for (size_t offset = 0; offset < size; offset += align) {
+        void* word = (char*) source + offset;
+        if (unlikely(tran->writes.contains(word))) {
+            auto it = tran->index.find(word);
+            if (it != tran->index.end()) {
+                memcpy((char*) target + offset, tran->redo.data() + it->second, align);
+                continue;
+            }
+        }
+        memcpy((char*) target + offset, word, align);
+        tran->reads.add(word);
+        shared_read = true;
+    }
+    if (likely(shared_read)) {
+        atomic_thread_fence(memory_order_acquire);
+        if (unlikely(!check(reg, tran))) {
+            removeT(reg, tran, true);
+            return false;
+        }
+    }
+    return true;
+}
+
+/** [thread-safe] Write operation in the given transaction, source in a private region and target in the shared region.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param source Source start address (in a private region)
+ * @param size   Length to copy (in bytes), must be a positive multiple of the alignment
+ * @param target Target start address (in the shared region)
+ * @return Whether the whole transaction can continue
+**/
+bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* target) noexcept {
+    Region* reg = (Region*) shared;
+    TransactionObject* tran = (TransactionObject*) tx;
+    size_t align = reg->align;
+    for (size_t offset = 0; offset < size; offset += align) {
+        void* word = (char*) target + offset;
+        auto it = tran->index.find(word);
+        size_t slot;
+        if (it != tran->index.end()) {
+            slot = it->second;
+        } else {
+            slot = tran->redo.size();
+            tran->redo.resize(slot + align);
+            tran->index[word] = slot;
+            tran->order_writes.push_back(word);
+            tran->writes.add(word);
+        }
+        memcpy(tran->redo.data() + slot, (char const*) source + offset, align);
+    }
+    return true;
+}
+
+/** [thread-safe] Memory allocation in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param size   Allocation requested size (in bytes), must be a positive multiple of the alignment
+ * @param target Pointer in private memory receiving the address of the first byte of the newly allocated, aligned segment
+ * @return Whether the whole transaction can continue (success/nomem), or not (abort_alloc)
+**/
+Alloc tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) noexcept {
+    Region* reg = (Region*) shared;
+    TransactionObject* tran = (TransactionObject*) tx;
+    void* seg;
+    if (unlikely(posix_memalign(&seg, max(reg->align, sizeof(void*)), size) != 0)) {
+        return Alloc::nomem;
+    }
+    memset(seg, 0, size);
+    tran->allocated.push_back(seg);
+    *target = seg;
+    return Alloc::success;
+}
+
+/** [thread-safe] Memory freeing in the given transaction.
+ * @param shared Shared memory region associated with the transaction
+ * @param tx     Transaction to use
+ * @param target Address of the first byte of the previously allocated segment to deallocate
+ * @return Whether the whole transaction can continue
+**/
+bool tm_free(shared_t shared as(unused), tx_t tx, void* target) noexcept {
+    TransactionObject* tran = (TransactionObject*) tx;
+    tran->freed.push_back(target);
+    return true;
+}